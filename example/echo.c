@@ -1,55 +1,44 @@
 #include "pl_readline.h"
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <termio.h>
 #include <unistd.h>
 
-int getch(void) {
-    struct termios tm, tm_old;
-    int            fd = 0;
+static struct termios tm_old;
 
-    if (tcgetattr(fd, &tm) < 0) return -1;
+static void restore_term(void) {
+    tcsetattr(0, TCSANOW, &tm_old);
+}
 
-    tm_old = tm;
+// 终端一直处于raw模式，转义序列交给库解码
+static bool raw_term(void) {
+    struct termios tm;
+    if (tcgetattr(0, &tm_old) < 0) return false;
+    tm = tm_old;
     cfmakeraw(&tm);
+    tm.c_oflag |= OPOST; // 输出的'\n'仍然换到行首
+    if (tcsetattr(0, TCSANOW, &tm) < 0) return false;
+    atexit(restore_term);
+    return true;
+}
 
-    if (tcsetattr(fd, TCSANOW, &tm) < 0) return -1;
-    int ch = getchar();
-
-    if (tcsetattr(fd, TCSANOW, &tm_old) < 0) return -1;
-
-    if (ch == 0x0d) { return PL_READLINE_KEY_ENTER; }
-    if (ch == 0x7f) { return PL_READLINE_KEY_BACKSPACE; }
-    if (ch == 0x9) { return PL_READLINE_KEY_TAB; }
-    if (ch == 0x1b) {
-        ch = getch();
-        if (ch == '[') {
-            ch = getch();
-            switch (ch) {
-            case 'A': return PL_READLINE_KEY_UP;
-            case 'B': return PL_READLINE_KEY_DOWN;
-            case 'C': return PL_READLINE_KEY_RIGHT;
-            case 'D': return PL_READLINE_KEY_LEFT;
-            case 'H': return PL_READLINE_KEY_HOME;
-            case 'F': return PL_READLINE_KEY_END;
-            case '5':
-                if (getch() == '~') return PL_READLINE_KEY_PAGE_UP;
-                break;
-            case '6':
-                if (getch() == '~') return PL_READLINE_KEY_PAGE_DOWN;
-                break;
-            default: return -1;
-            }
-        }
-    }
-    return ch;
+int read_in(char *buf, size_t len) {
+    ssize_t n;
+    while ((n = read(0, buf, len)) < 0 && errno == EINTR) {} // 被信号打断时重试
+    return n;
 }
 
 void flush(void) {
     fflush(stdout);
 }
 
+int write_out(const char *buf, size_t len) {
+    return fwrite(buf, 1, len, stdout);
+}
+
 // 统计`/`的个数
 static int count_slash(const char *buf) {
     int count = 0;
@@ -60,34 +49,37 @@ static int count_slash(const char *buf) {
     return count;
 }
 
-void handle_tab(char *buf, pl_readline_words_t words) {
-    pl_readline_word_maker_add("ls", words, true, PL_COLOR_GREEN, ' ');
-    pl_readline_word_maker_add("echo", words, true, PL_COLOR_BLUE, ' ');
-    pl_readline_word_maker_add("cat", words, true, PL_COLOR_RED, ' ');
-    pl_readline_word_maker_add("ps", words, true, PL_COLOR_CYAN, ' ');
-    pl_readline_word_maker_add("exit", words, true, PL_COLOR_BLUE, ' ');
-    pl_readline_word_maker_add("history", words, true, PL_COLOR_CYAN, ' ');
-    pl_readline_word_maker_add("foo", words, false, PL_COLOR_YELLOW, ' ');
-    pl_readline_word_maker_add("bar", words, false, PL_COLOR_MAGENTA, ' ');
+// 固定不变的词放进词库，回调只负责随输入变化的部分
+static void add_commands(pl_readline_t pl) {
+    pl_readline_dict_add(pl, "ls", true, PL_COLOR_GREEN, ' ');
+    pl_readline_dict_add(pl, "echo", true, PL_COLOR_BLUE, ' ');
+    pl_readline_dict_add(pl, "cat", true, PL_COLOR_RED, ' ');
+    pl_readline_dict_add(pl, "ps", true, PL_COLOR_CYAN, ' ');
+    pl_readline_dict_add(pl, "exit", true, PL_COLOR_BLUE, ' ');
+    pl_readline_dict_add(pl, "history", true, PL_COLOR_CYAN, ' ');
+    pl_readline_dict_add(pl, "foo", false, PL_COLOR_YELLOW, ' ');
+    pl_readline_dict_add(pl, "bar", false, PL_COLOR_MAGENTA, ' ');
+}
 
+void handle_tab(char *buf, pl_readline_words_t words) {
     int   current     = words->len;
     char *fake_dirs[] = {"/home", "/usr", "/home/racaos", "/usr/local", NULL};
     // 匹配buf，看看有没有匹配的
     for (int i = 0; fake_dirs[i] != NULL; i++) {
         if (strncmp(buf, fake_dirs[i], strlen(buf)) == 0 && strlen(buf) != strlen(fake_dirs[i])) {
             if (count_slash(fake_dirs[i]) == count_slash(buf)) {
-                pl_readline_word_maker_add(fake_dirs[i], words, false, PL_COLOR_YELLOW, '/');
+                pl_readline_word_maker_add_ref(fake_dirs[i], words, false, PL_COLOR_YELLOW, '/');
             }
         }
     }
     if (strcmp(buf, "/") == 0) {
         // 只是为了让其着色
-        pl_readline_word_maker_add("/", words, false, PL_COLOR_YELLOW, ' ');
+        pl_readline_word_maker_add_ref("/", words, false, PL_COLOR_YELLOW, ' ');
     }
     if (words->len - current == 0) {
         for (int i = 0; fake_dirs[i] != NULL; i++) {
             if (strcmp(buf, fake_dirs[i]) == 0) {
-                pl_readline_word_maker_add(fake_dirs[i], words, false, PL_COLOR_YELLOW, '/');
+                pl_readline_word_maker_add_ref(fake_dirs[i], words, false, PL_COLOR_YELLOW, '/');
                 break;
             }
         }
@@ -95,13 +87,23 @@ void handle_tab(char *buf, pl_readline_words_t words) {
 }
 
 int main(void) {
-    pl_readline_t pl = pl_readline_init(getch, putchar, flush, handle_tab);
-#if PL_ENABLE_HISTORY_FILE
+    if (!raw_term()) return 1;
+    pl_readline_t pl = pl_readline_init(NULL, putchar, flush, handle_tab);
+    pl->pl_readline_hal_write = write_out;
+    pl->pl_readline_hal_read  = read_in;
+    pl->bracketed_paste       = true;
+    add_commands(pl);
+    pl_readline_set_history_dups(pl, PL_READLINE_HISTORY_DUPS_ERASE); // 重复的命令只保留最新一条
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    pl_readline_history_open(pl, ".pl_history"); // 每一行提交后都会追加到文件里
+    pl_readline_history_share(pl, true); // 同时运行的其他 echo 输入的命令也能翻到
+#elif PL_ENABLE_HISTORY_FILE
     pl_readline_load_history(pl, ".pl_history");
 #endif
     printf("Type 'exit' to quit!\n");
     while (1) {
         const char *buffer = pl_readline(pl, "\033[1;32m[user@localhost]$\033[0m ");
+        if (!buffer) break; // 输入已经结束
 
         // Check if it is a valid exit command
         int is_exit = 1;
@@ -119,16 +121,12 @@ int main(void) {
             is_exit = 0;
         }
         if (strcmp(buffer, "history") == 0) {
-            list_t node = pl->history;
-            // Find the last node
-            while (node && node->next)
-                node = node->next;
-            // Write from last to first, skipping the empty last entry
-            int i = 1;
-            while (node) {
-                if (node->data && ((char *)node->data)[0] != '\0')
-                    printf("%d: %s\n", i++, (char *)node->data);
-                node = node->prev;
+            // Write from oldest to newest
+            size_t count = pl_readline_history_count(pl->history);
+            for (size_t i = 0; i < count; i++) {
+                size_t      len;
+                const char *line = pl_readline_history_get(pl->history, i, &len);
+                printf("%zu: %.*s\n", i + 1, (int)len, line);
             }
             continue;
         }
@@ -136,7 +134,7 @@ int main(void) {
         if (is_exit) break;
         printf("Your input: %s\n", buffer);
     }
-#if PL_ENABLE_HISTORY_FILE
+#if PL_ENABLE_HISTORY_FILE && !PL_ENABLE_POSIX
     pl_readline_save_history(pl, ".pl_history");
 #endif
     pl_readline_uninit(pl);
@@ -18,20 +18,28 @@
 #define PL_COLOR_MAGENTA 35
 #define PL_COLOR_CYAN    36
 #define PL_COLOR_WHITE   37
+#define PL_COLOR_GRAY    90
 
-#define PL_READLINE_KEY_UP        0xff00
-#define PL_READLINE_KEY_DOWN      0xff01
-#define PL_READLINE_KEY_LEFT      0xff02
-#define PL_READLINE_KEY_RIGHT     0xff03
-#define PL_READLINE_KEY_HOME      0xff04
-#define PL_READLINE_KEY_END       0xff05
-#define PL_READLINE_KEY_PAGE_UP   0xff06
-#define PL_READLINE_KEY_PAGE_DOWN 0xff07
-#define PL_READLINE_KEY_ENTER     '\n'
-#define PL_READLINE_KEY_TAB       '\t'
-#define PL_READLINE_KEY_CTRL_A    0x01
-#define PL_READLINE_KEY_CTRL_C    0x03
-#define PL_READLINE_KEY_BACKSPACE '\b'
+#define PL_READLINE_KEY_UP          0xff00
+#define PL_READLINE_KEY_DOWN        0xff01
+#define PL_READLINE_KEY_LEFT        0xff02
+#define PL_READLINE_KEY_RIGHT       0xff03
+#define PL_READLINE_KEY_HOME        0xff04
+#define PL_READLINE_KEY_END         0xff05
+#define PL_READLINE_KEY_PAGE_UP     0xff06
+#define PL_READLINE_KEY_PAGE_DOWN   0xff07
+#define PL_READLINE_KEY_PASTE_START 0xff08 // 括号粘贴开始（ESC[200~）
+#define PL_READLINE_KEY_PASTE_END   0xff09 // 括号粘贴结束（ESC[201~）
+#define PL_READLINE_KEY_WORD_LEFT   0xff0a // 移动到上一个单词开头（Ctrl+Left）
+#define PL_READLINE_KEY_WORD_RIGHT  0xff0b // 移动到下一个单词结尾（Ctrl+Right）
+#define PL_READLINE_KEY_ENTER       '\n'
+#define PL_READLINE_KEY_TAB         '\t'
+#define PL_READLINE_KEY_CTRL_A      0x01
+#define PL_READLINE_KEY_CTRL_C      0x03
+#define PL_READLINE_KEY_CTRL_G      0x07 // 取消搜索
+#define PL_READLINE_KEY_CTRL_R      0x12 // 向前（更旧）搜索历史记录
+#define PL_READLINE_KEY_CTRL_S      0x13 // 向后（更新）搜索历史记录
+#define PL_READLINE_KEY_BACKSPACE   '\b'
 
 #define _self                          pl_readline_t self
 #define PL_READLINE_SUCCESS            0
@@ -42,9 +50,71 @@
 #ifndef PL_ENABLE_HISTORY_FILE
 #    define PL_ENABLE_HISTORY_FILE 1
 #endif
+#ifndef PL_ENABLE_POSIX // 是否可以使用 POSIX 接口（文件锁、fsync 等）
+#    if defined(__unix__) && __STDC_HOSTED__
+#        define PL_ENABLE_POSIX 1
+#    else
+#        define PL_ENABLE_POSIX 0
+#    endif
+#endif
+#ifndef PL_ENABLE_SHARED_DICT // 是否可以使用 C11 原子操作（多个实例共用词库）
+#    if __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#        define PL_ENABLE_SHARED_DICT 1
+#    else
+#        define PL_ENABLE_SHARED_DICT 0
+#    endif
+#endif
+#ifndef PL_ENABLE_ASYNC_COMPLETION // 是否可以使用 pthread（异步补全）
+#    define PL_ENABLE_ASYNC_COMPLETION PL_ENABLE_POSIX
+#endif
+#ifndef PL_ENABLE_SIMD // 模糊匹配是否使用 SSE2/AVX2（编译器也要打开了对应的指令集）
+#    define PL_ENABLE_SIMD 1
+#endif
 #ifndef PL_ENABLE_COLOR_FIRST_WORD_ONLY
 #    define PL_ENABLE_COLOR_FIRST_WORD_ONLY 1
 #endif
+#ifndef PL_READLINE_HISTORY_MAX
+#    define PL_READLINE_HISTORY_MAX 1000 // 默认最多保存的历史记录数，可用 pl_readline_set_history_max 修改
+#endif
+#ifndef PL_READLINE_HISTORY_SYNC_COUNT
+#    define PL_READLINE_HISTORY_SYNC_COUNT 8 // 攒够多少行写一次历史记录文件
+#endif
+#ifndef PL_READLINE_HISTORY_SYNC_SECS
+#    define PL_READLINE_HISTORY_SYNC_SECS 2 // 待写入的行最多攒多少秒
+#endif
+#ifndef PL_READLINE_HISTORY_GONE
+#    define PL_READLINE_HISTORY_GONE 32 // 最近删掉的多少条记录留着内容，让索引可以按内容找到并删掉它们
+#endif
+#ifndef PL_READLINE_HISTORY_FILE_MAX
+#    define PL_READLINE_HISTORY_FILE_MAX 10000 // 压缩后历史记录文件最多保留的行数
+#endif
+#ifndef PL_READLINE_READ_SIZE
+#    define PL_READLINE_READ_SIZE 256 // pl_readline_hal_read 一次最多读多少字节
+#endif
+#ifndef PL_READLINE_IDLE_KEEP
+#    define PL_READLINE_IDLE_KEEP 128 // 一行开始时，容量超过这么多字节的缓冲区会被释放
+#endif
+#ifndef PL_READLINE_COMPLETION_TIMEOUT
+#    define PL_READLINE_COMPLETION_TIMEOUT 300 // 异步补全最多等多少毫秒，之后显示已经给出的部分
+#endif
+#ifndef PL_READLINE_FUZZY_TOP
+#    define PL_READLINE_FUZZY_TOP 64 // 模糊补全最多列出多少个候选词
+#endif
+#ifndef PL_ENABLE_AUTOSUGGEST
+#    define PL_ENABLE_AUTOSUGGEST 1 // 光标在行尾时用灰色显示历史记录中的建议
+#endif
+#ifndef PL_READLINE_SUGGEST_BUDGET
+#    define PL_READLINE_SUGGEST_BUDGET 1000 // 每次按键最多花多少微秒整理建议的索引
+#endif
+#ifndef PL_READLINE_SUGGEST_RUN
+#    define PL_READLINE_SUGGEST_RUN 256 // 建议的索引里先不合并进主体的新记录最多有多少条
+#endif
+#ifndef PL_READLINE_WORDS_ARENA_SIZE
+#    define PL_READLINE_WORDS_ARENA_SIZE 1024 // 词组内存池第一块的大小
+#endif
+#ifndef PL_READLINE_COLOR_CACHE_SIZE
+#    define PL_READLINE_COLOR_CACHE_SIZE 64 // 着色缓存的槽位数，必须是2的幂
+#endif
 
 
 typedef struct pl_readline_word {
@@ -61,40 +131,304 @@ typedef struct pl_readline_word {
 } pl_readline_word;
 
 typedef struct pl_readline_words {
-    isize            len;     // 词组数量
-    isize            max_len; // 词组最大数量
-    pl_readline_word *words;   // 词组列表
+    isize                           len;     // 词组数量
+    isize                           max_len; // 词组最大数量
+    pl_readline_word               *words;   // 词组列表
+    struct pl_readline_arena_chunk *chunks;  // 存放字符串的内存池
+    struct pl_readline_arena_chunk *chunk;   // 正在分配的块
+    usize                           used;    // 当前块已用的字节数
 } *pl_readline_words_t;
 
+// 历史记录（环形数组 + 字符串池），见plreadln_history.c
+typedef struct pl_readline_history *pl_readline_history_t;
+
+// 一条历史记录的附加信息
+typedef struct pl_readline_history_meta {
+    int64_t     time;    // 提交的时间（Unix 时间戳），0为未知
+    int         status;  // 命令的退出状态
+    const char *cwd;     // 执行时的工作目录，不以'\0'结尾
+    usize       cwd_len;
+} pl_readline_history_meta;
+
+// 历史记录文件的格式，二进制格式以 PL_READLINE_HISTORY_MAGIC 开头
+#define PL_READLINE_HISTORY_TEXT   0
+#define PL_READLINE_HISTORY_BINARY 1
+#define PL_READLINE_HISTORY_MAGIC  "\177PLHIST1"
+// 重复的记录怎么处理，见 pl_readline_set_history_dups
+#define PL_READLINE_HISTORY_DUPS_KEEP   0 // 都保留
+#define PL_READLINE_HISTORY_DUPS_IGNORE 1 // 和上一条相同时不添加
+#define PL_READLINE_HISTORY_DUPS_ERASE  2 // 添加时删掉之前相同的记录
+
+// 增量写入的历史记录文件，见plreadln_histfile.c
+typedef struct pl_readline_history_file *pl_readline_history_file_t;
+
+// 历史记录的增量搜索（Ctrl-R / Ctrl-S），见plreadln_search.c
+typedef struct pl_readline_search *pl_readline_search_t;
+// 按前缀翻看历史记录（上下方向键），见plreadln_prefix.c
+typedef struct pl_readline_prefix *pl_readline_prefix_t;
+
+// 常驻的补全词库（基数树），见plreadln_dict.c
+typedef struct pl_readline_dict *pl_readline_dict_t;
+// 多个实例共用的词库和它的一个版本，见plreadln_dictshare.c
+typedef struct pl_readline_shared_dict  *pl_readline_shared_dict_t;
+typedef struct pl_readline_dict_version *pl_readline_dict_version_t;
+// 模糊补全用的词库索引，见plreadln_fuzzy.c
+typedef struct pl_readline_fuzzy *pl_readline_fuzzy_t;
+// 一次异步补全请求，见plreadln_async.c
+typedef struct pl_readline_request *pl_readline_request_t;
+// 高亮回调给出的区间和还没交给回调的范围，见plreadln_highlight.c
+typedef struct pl_readline_spans *pl_readline_spans_t;
+// 括号粘贴模式下攒着的粘贴内容，见plreadln.c
+typedef struct pl_readline_paste *pl_readline_paste_t;
+
+typedef struct pl_readline_stats {
+    usize keys;               // 已处理的按键数
+    usize write_calls;        // 输出回调的总调用次数
+    usize write_bytes;        // 总输出字节数
+    usize last_write_calls;   // 上一次按键产生的输出回调调用次数
+    usize last_write_bytes;   // 上一次按键产生的输出字节数
+    usize color_cache_hits;   // 着色缓存命中次数
+    usize color_cache_misses; // 着色缓存未命中次数
+    usize words_calls;        // 补全回调的调用次数
+    usize words_narrowed;     // 在缓存的候选词里筛选、没有调用补全回调的次数
+} pl_readline_stats;
+
+// 调用过 pl_readline_get_stats 之后才计数
+#define PL_READLINE_COUNT(self, field, n)                                                          \
+    do {                                                                                           \
+        if ((self)->stats) (self)->stats->field += (n);                                            \
+    } while (0)
+
+#define PL_READLINE_TOKEN_WORD    0x00 // 普通单词
+#define PL_READLINE_TOKEN_QUOTED  0x01 // 含有引号或转义
+#define PL_READLINE_TOKEN_OPEN    0x02 // 引号没有闭合，延续到行尾
+#define PL_READLINE_TOKEN_COLORED 0x80 // color 字段有效
+
+// 输入行中的一个单词
+typedef struct pl_readline_token {
+    isize   start; // 起始位置
+    isize   len;   // 长度
+    uint8_t kind;  // PL_READLINE_TOKEN_*
+    uint8_t color; // ANSI颜色
+} pl_readline_token;
+
+// 着色缓存的一项
+typedef struct pl_readline_color_entry {
+    char    *word;       // 单词
+    uint32_t generation; // 写入时的代数，和pl_readline的不一致就作废
+    uint16_t check;      // 哈希的高16位，不一样就不用比较单词了
+    uint8_t  color;      // ANSI颜色
+    bool     first;      // 是否作为第一个单词着色
+} pl_readline_color_entry;
+
+// 高亮回调给出的一个着色区间
+typedef struct pl_readline_span {
+    isize start; // 起始位置
+    isize len;   // 长度
+    int   color; // ANSI颜色
+} pl_readline_span;
+
+// 高亮回调通过 pl_readline_span_add 把区间交回来
+typedef struct pl_readline_span_sink *pl_readline_span_sink_t;
+
+// 屏幕上的一个字符单元
+typedef struct pl_readline_cell {
+    char    ch;    // 字符
+    uint8_t color; // ANSI颜色
+} pl_readline_cell;
+
+// 终端输入的解码器，见plreadln_input.c
+typedef struct pl_readline_decoder {
+    uint8_t state;    // 正在解码的序列
+    uint8_t nparam;   // 正在读第几个参数
+    int     param[2]; // CSI序列的参数（第二个是修饰键）
+} pl_readline_decoder;
+
 typedef struct pl_readline {
-    int (*pl_readline_hal_getch)(void);                       // 输入函数
+    int (*pl_readline_hal_getch)(void);                       // 输入函数，返回负数表示输入结束
     int (*pl_readline_hal_putch)(int ch);                     // 输出函数
     void (*pl_readline_hal_flush)(void);                      // 刷新函数
+    /**
+      批量输出函数（可选），返回写出的字节数，小于等于0表示失败
+      设置后每次按键的输出只调用一次（或少数几次）该函数，
+      为NULL时退回到逐字节调用pl_readline_hal_putch
+    */
+    int (*pl_readline_hal_write)(const char *buf, size_t len);
+    /**
+      批量输入函数（可选），读入原始字节，返回读到的字节数，小于等于0表示失败
+      设置后由库解码转义序列，一次读到的多个按键会依次处理，
+      此时不再调用pl_readline_hal_getch
+      返回0（输入结束）或失败时，正在读的一行就此结束，pl_readline返回NULL，
+      需要重试的错误（如EINTR）应该在函数内部处理
+    */
+    int (*pl_readline_hal_read)(char *buf, size_t len);
     void (*pl_readline_get_words)(char               *buf,
                                   pl_readline_words_t words); // 获取词组列表
-    char  *buffer;                                            // 输入缓冲区
-    char  *input_buf;                                         // 输入缓冲区（补全的前缀）
-    isize ptr;                                                // 输入缓冲区指针
-    isize input_ptr;                                          // 输入缓冲区（补全的前缀）指针
+    /**
+      高亮函数（可选），设置后代替按词库着色
+      buf是输入行中需要重新着色的一段（不一定从行首开始），
+      对其中每个需要着色的区间调用 pl_readline_span_add(sink, 偏移, 长度, 颜色)
+    */
+    void (*pl_readline_highlight)(const char *buf, size_t len, pl_readline_span_sink_t sink);
+    char  *buffer;                                            // 输入缓冲区（间隙缓冲区，见plreadln_buffer.c）
+    isize ptr;                                                // 光标位置
+    isize gap;                                                // 间隙的起始位置
     isize maxlen;                                             // 缓冲区最大长度
     isize length;                                             // 输入缓冲区长度（已经输入的字符数）
-    list_t history;                                           // 历史记录列表
-    int    history_idx;                                       // 历史记录指针
+    pl_readline_history_t history;                            // 历史记录
+    int    history_idx;                                       // 正在查看倒数第几条历史记录，0为输入行
+    char  *history_line;                                      // 翻看历史记录时暂存的输入行
+    usize  history_line_cap;
+    pl_readline_history_file_t history_file;                  // pl_readline_history_open 打开的文件
     char  *prompt;                                            // 提示符
     bool   intellisense_mode;                                 // 智能补全模式
     char  *intellisense_word;                                 // 智能补全词组
 
 
-    // for color
-    char **color_words;                                       // 词组列表（用于判断并着色）
-    int color_max_words;
+    // for render
+    pl_readline_cell *frame;                                  // 上一次绘制到终端上的内容，后一半是正在生成的新一帧
+    isize             frame_len;                              // 上一帧的长度
+    isize             frame_cap;                              // 每一帧的容量
+    isize             term_pos;                               // 终端光标所在的单元（提示符之后）
+    isize             dirty_from;                             // 这个位置之后的内容需要重新生成
+    char             *annotation;                             // 画在输入行后面的提示（不属于输入内容）
+    isize             annotation_len;
+    isize             annotation_cap;
+    int               annotation_color;
+
+    // for token
+    pl_readline_token *tokens;                                // 单词索引，按位置排序
+    isize              token_count;                           // 单词数量
+    isize              token_cap;                             // 单词索引容量
+    pl_readline_token *token_scratch;                         // 重新切分时的临时空间
+    isize              token_scratch_cap;
+
+    // for color cache
+    pl_readline_color_entry *color_cache;                     // 着色缓存，按需分配
+    uint32_t                 color_generation;                // 着色缓存的代数
+
+    // for history search
+    pl_readline_search_t search; // 第一次搜索时创建
+    pl_readline_prefix_t prefix; // 第一次翻看历史记录或显示建议时创建
+
+    // for completion
+    pl_readline_dict_t  dict;       // pl_readline_dict_add 注册的词库，按需创建
+    pl_readline_words_t words;      // 交给 pl_readline_get_words 的候选词，每次 tab 前清空，按需创建
+    pl_readline_words_t words_temp; // 着色查词库、列出词库时用的临时词组，按需创建
+    // 下面两个字段和异步补全的字段一样，不管库有没有编译进这个功能都在，
+    // 结构体的布局不随使用者编译时看到的 PL_ENABLE_* 变化
+    pl_readline_shared_dict_t  shared_dict;  // pl_readline_attach_dict 挂上的共用词库
+    pl_readline_dict_version_t dict_version; // 正在使用的版本，挂上时代替 dict
+
+    // for candidate narrowing
+    bool                narrow;           // 是否在缓存的候选词里筛选，见 pl_readline_narrow_words
+    pl_readline_words_t cand;             // 上一次回调给出的候选词，只留下以 cand_prefix 开头的
+    char               *cand_prefix;      // NULL表示没有缓存
+    uint32_t            cand_generation;  // 缓存时的 words_generation
+    uint32_t            words_generation; // pl_readline_words_changed 时加一
+
+    // for fuzzy completion
+    bool                fuzzy_mode; // 按子序列匹配并打分，见 pl_readline_set_fuzzy
+    pl_readline_fuzzy_t fuzzy;      // 实例自己的词库的索引，第一次模糊补全时建立
+
+    // for highlight
+    pl_readline_spans_t spans; // 设置了 pl_readline_highlight 时第一次重绘创建，NULL时整行都要交给回调
+
+    // for paste
+    bool                bracketed_paste; // 是否打开终端的括号粘贴模式
+    pl_readline_paste_t paste;           // 正在接收粘贴的内容，粘贴开始时创建、结束时释放
+
+    // for input
+    char               *in_buf;                               // 读入或送入了但还没解码的字节
+    usize               in_pos;                               // 下一个要解码的字节
+    usize               in_len;
+    usize               in_cap;
+    pl_readline_decoder decoder;                              // 跨越多次读取的解码状态
+    bool                reading;                              // pl_readline_begin 之后，一行还没结束
+    bool                line_ready;                           // 有一行等着 pl_readline_take_line 取走
+
+    // for output
+    char              *out_buf;                               // 输出缓冲区，每次按键结束时统一刷新
+    usize              out_len;                               // 输出缓冲区已用长度
+    usize              out_cap;                               // 输出缓冲区容量
+    int                key_depth;                             // pl_readline_handle_key 的嵌套深度
+    pl_readline_stats *stats;                                 // 统计，第一次调用 pl_readline_get_stats 时创建
+
+    // for async completion
+    /**
+      异步获取词组列表（可选），设置后代替pl_readline_get_words
+      应该尽快返回，在别的线程里用 pl_readline_request_add 给出候选词，
+      最后调用一次 pl_readline_request_finish
+      库没有编译进异步补全（PL_ENABLE_ASYNC_COMPLETION 为0）时不会调用
+    */
+    void (*pl_readline_get_words_async)(pl_readline_request_t req);
+    pl_readline_request_t pending;            // 还在等待的请求
+    int                   completion_timeout; // 每个请求最多等多少毫秒
 } *pl_readline_t;
 
 void pl_readline_insert_char(char *str, char ch, int idx);
 void pl_readline_delete_char(char *str, int idx);
 int pl_readline_add_history(_self, char *line);
 int pl_readline_modify_history(_self);
+int pl_readline_set_history_max(_self, usize max);
+pl_readline_history_t pl_readline_history_new(usize max);
+void pl_readline_history_free(pl_readline_history_t history);
+pl_readline_history_t pl_readline_history_ref(pl_readline_history_t history);
+usize pl_readline_history_refs(pl_readline_history_t history);
+usize pl_readline_history_memory(pl_readline_history_t history);
+bool pl_readline_history_add(pl_readline_history_t history, const char *line, usize len,
+                             bool *added);
+bool pl_readline_history_replace(pl_readline_history_t history, usize idx, const char *line,
+                                 usize len);
+usize pl_readline_history_count(pl_readline_history_t history);
+const char *pl_readline_history_get(pl_readline_history_t history, usize idx, usize *len);
+bool pl_readline_history_set_max(pl_readline_history_t history, usize max);
+bool pl_readline_history_get_meta(pl_readline_history_t history, usize idx,
+                                  pl_readline_history_meta *meta);
+bool pl_readline_history_set_meta(pl_readline_history_t history, usize idx,
+                                  const pl_readline_history_meta *meta);
+int  pl_readline_set_history_status(_self, int status, const char *cwd);
+uint64_t pl_readline_history_first_seq(pl_readline_history_t history);
+uint64_t pl_readline_history_end_seq(pl_readline_history_t history);
+uint64_t pl_readline_history_removed(pl_readline_history_t history);
+bool     pl_readline_history_removed_at(pl_readline_history_t history, uint64_t n, uint64_t *seq,
+                                        uint32_t *line);
+void     pl_readline_history_watch(pl_readline_history_t history, bool watch);
+void     pl_readline_history_line_hold(pl_readline_history_t history, uint32_t id);
+void     pl_readline_history_line_drop(pl_readline_history_t history, uint32_t id);
+uint64_t pl_readline_history_seq(pl_readline_history_t history, usize idx);
+usize    pl_readline_history_lower_bound(pl_readline_history_t history, uint64_t seq);
+bool     pl_readline_history_find(pl_readline_history_t history, uint64_t seq, usize *idx);
+uint32_t pl_readline_history_line_id(pl_readline_history_t history, usize idx);
+const char *pl_readline_history_line(pl_readline_history_t history, uint32_t id, usize *len);
+void     pl_readline_history_set_dups(pl_readline_history_t history, int dups);
+int      pl_readline_set_history_dups(_self, int dups);
+int      pl_readline_share_history(_self, pl_readline_t other);
+bool pl_readline_search_key(_self, int ch);
+bool pl_readline_search_active(_self);
+void pl_readline_search_free(_self);
+void pl_readline_search_index_add(_self);
+void pl_readline_search_touch(_self, uint64_t seq);
+usize pl_readline_search_memory(_self);
+void pl_readline_search_trim(_self);
+bool pl_readline_prefix_up(_self);
+bool pl_readline_prefix_down(_self);
+void pl_readline_prefix_touch(_self, uint64_t seq);
+void pl_readline_prefix_free(_self);
+usize pl_readline_prefix_memory(_self);
+void pl_readline_prefix_trim(_self);
+void pl_readline_suggest_refresh(_self);
+bool pl_readline_suggest_accept(_self);
+void pl_readline_suggest_enable(_self, bool enable);
+void pl_readline_set_annotation(_self, const char *text, isize len, int color);
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+usize pl_readline_history_map(pl_readline_history_t history, int fd, usize limit);
+int   pl_readline_open_locked(const char *path, int flags, int op);
+int   pl_readline_replace_open(const char *dest, int lock, char *tmp);
+bool  pl_readline_replace_commit(const char *tmp, const char *dest, bool ok);
+#endif
 pl_readline_words_t pl_readline_word_maker_init(void);
+pl_readline_words_t pl_readline_word_maker_get(pl_readline_words_t *words);
 pl_readline_t       pl_readline_init(int (*pl_readline_hal_getch)(void),
                                      int (*pl_readline_hal_putch)(int ch),
                                      void (*pl_readline_hal_flush)(void),
@@ -102,20 +436,147 @@ pl_readline_t       pl_readline_init(int (*pl_readline_hal_getch)(void),
 const char         *pl_readline(_self, char *prompt);
 pl_readline_word    pl_readline_intellisense(_self, pl_readline_words_t words);
 void                pl_readline_insert_char_and_view(_self, char ch);
+void                pl_readline_insert_string(_self, const char *str, size_t len);
 void                pl_readline_insert_char(char *str, char ch, int idx);
 int  pl_readline_word_maker_add(char *word, pl_readline_words_t words, bool is_first, int color,
                                 char sep);
-void pl_readline_print(_self, char *str);
+int  pl_readline_word_maker_add_ref(const char *word, pl_readline_words_t words, bool is_first,
+                                    int color, char sep);
+void pl_readline_word_maker_clear(pl_readline_words_t words);
+usize pl_readline_word_maker_memory(pl_readline_words_t words);
+void pl_readline_word_maker_trim(pl_readline_words_t words, usize keep);
+void pl_readline_print(_self, const char *str);
+void pl_readline_write(_self, const char *buf, usize len);
+void pl_readline_putch(_self, int ch);
+void pl_readline_flush(_self);
 void pl_readline_intellisense_insert(_self, pl_readline_word words);
 void pl_readline_word_maker_destroy(pl_readline_words_t words);
 void pl_readline_next_line(_self);
 int  pl_readline_handle_key(_self, int ch);
+int  pl_readline_decode(pl_readline_decoder *dec, int byte);
+int  pl_readline_read_key(_self);
+bool pl_readline_input_append(_self, const char *bytes, usize len);
+void pl_readline_begin(_self, char *prompt);
+int  pl_readline_feed(_self, const char *bytes, usize len);
+const char *pl_readline_take_line(_self);
+void pl_readline_trim_line(_self);
+void pl_readline_trim(_self);
+usize pl_readline_memory_usage(_self);
+usize pl_readline_paste_memory(_self);
+pl_readline_stats *pl_readline_get_stats(_self);
+void pl_readline_complete(_self, bool fetch);
+char *pl_readline_completion_word(_self);
+pl_readline_words_t pl_readline_fetch_words(_self, const char *prefix, pl_readline_words_t words);
+pl_readline_words_t pl_readline_fetch_words_uncached(_self, const char *prefix,
+                                                     pl_readline_words_t words);
+void pl_readline_narrow_words(_self, bool enable);
+void pl_readline_words_changed(_self);
+void pl_readline_candidates_trim(_self);
+void pl_readline_candidates_free(_self);
+usize pl_readline_candidates_memory(_self);
+void pl_readline_set_fuzzy(_self, bool enable);
+usize pl_readline_fuzzy_match(_self, const char *query, bool is_first, pl_readline_words_t extra,
+                              pl_readline_word *out, usize k);
+int   pl_readline_fuzzy_score(const char *word, usize len, const char *query);
+pl_readline_word pl_readline_intellisense_fuzzy(_self, pl_readline_words_t words, bool fetch);
+void  pl_readline_fuzzy_free(_self);
+usize pl_readline_fuzzy_memory(_self);
+pl_readline_fuzzy_t pl_readline_fuzzy_index_new(pl_readline_dict_t dict);
+void  pl_readline_fuzzy_index_free(pl_readline_fuzzy_t fuzzy);
+usize pl_readline_fuzzy_index_memory(pl_readline_fuzzy_t fuzzy);
+pl_readline_word pl_readline_intellisense_ready(_self, pl_readline_words_t words);
+#if PL_ENABLE_ASYNC_COMPLETION
+const char *pl_readline_request_word(pl_readline_request_t req);
+bool pl_readline_request_cancelled(pl_readline_request_t req);
+int  pl_readline_request_add(pl_readline_request_t req, const char *word, bool first, int color,
+                             char sep);
+void pl_readline_request_finish(pl_readline_request_t req);
+void pl_readline_set_completion_timeout(_self, int ms);
+int  pl_readline_poll(_self);
+bool pl_readline_async_start(_self);
+void pl_readline_async_cancel(_self);
+void pl_readline_async_wait(_self);
+#endif
 void pl_readline_uninit(_self);
 int get_command_color(_self, const char *word, int is_first_word);
+int  pl_readline_word_color(_self, const char *word, bool is_first);
+void pl_readline_invalidate_colors(_self);
+void pl_readline_color_cache_free(_self);
+void pl_readline_color_cache_trim(_self);
+usize pl_readline_color_cache_memory(_self);
+void pl_readline_span_add(pl_readline_span_sink_t sink, size_t offset, size_t len, int color);
+void pl_readline_spans_update(_self, isize pos, isize removed, isize inserted, isize from, isize to);
+void pl_readline_spans_reset(_self);
+void pl_readline_spans_refresh(_self);
+void pl_readline_spans_paint(_self, pl_readline_cell *cells, isize from);
+usize pl_readline_spans_memory(_self);
+void pl_readline_spans_trim(_self);
+void pl_readline_spans_free(_self);
 void redisplay_buffer_with_colors(_self, int show_prompt);
+void pl_readline_frame_reset(_self);
+void pl_readline_buffer_move_gap(_self, isize pos);
+bool pl_readline_buffer_reserve(_self, isize extra);
+bool pl_readline_buffer_insert(_self, isize pos, const char *str, isize len);
+void pl_readline_buffer_delete(_self, isize pos, isize len);
+char pl_readline_buffer_at(_self, isize idx);
+void pl_readline_buffer_copy(_self, isize from, isize to, char *dst);
+char *pl_readline_buffer_view(_self);
+void pl_readline_buffer_clear(_self);
+bool pl_readline_buffer_set(_self, const char *str, isize len);
+void pl_readline_tokens_update(_self, isize pos, isize removed, isize inserted);
+void pl_readline_tokens_reset(_self);
+isize pl_readline_token_at(_self, isize pos);
+bool pl_readline_token_is_first(_self, isize start);
+isize pl_readline_word_start(_self);
+isize pl_readline_word_left(_self);
+isize pl_readline_word_right(_self);
+void pl_readline_move_cursor(_self, isize pos);
+int  pl_readline_dict_add(_self, const char *word, bool first, int color, char sep);
+int  pl_readline_dict_remove(_self, const char *word);
+pl_readline_dict_t pl_readline_dict_new(void);
+void pl_readline_dict_free(pl_readline_dict_t dict);
+usize pl_readline_dict_memory(pl_readline_dict_t dict);
+bool pl_readline_dict_insert(pl_readline_dict_t dict, const char *word, bool first, int color,
+                             char sep);
+bool pl_readline_dict_erase(pl_readline_dict_t dict, const char *word);
+bool pl_readline_dict_lookup(pl_readline_dict_t dict, const char *word, isize len,
+                             pl_readline_word *out);
+usize pl_readline_dict_count(pl_readline_dict_t dict, const char *prefix, isize len, bool is_first);
+char *pl_readline_dict_common_prefix(pl_readline_dict_t dict, const char *prefix, isize len,
+                                     bool is_first);
+void pl_readline_dict_collect(pl_readline_dict_t dict, const char *prefix, isize len, bool is_first,
+                              pl_readline_words_t out);
+pl_readline_dict_t pl_readline_dict_clone(pl_readline_dict_t dict);
+pl_readline_dict_t pl_readline_dict_current(_self);
+#if PL_ENABLE_SHARED_DICT
+pl_readline_shared_dict_t pl_readline_shared_dict_new(void);
+void pl_readline_shared_dict_release(pl_readline_shared_dict_t shared);
+int  pl_readline_shared_dict_publish(pl_readline_shared_dict_t shared, pl_readline_dict_t dict);
+pl_readline_dict_t pl_readline_shared_dict_copy(pl_readline_shared_dict_t shared);
+int  pl_readline_shared_dict_add(pl_readline_shared_dict_t shared, const char *word, bool first,
+                                 int color, char sep);
+int  pl_readline_shared_dict_remove(pl_readline_shared_dict_t shared, const char *word);
+int  pl_readline_attach_dict(_self, pl_readline_shared_dict_t shared);
+void pl_readline_dict_sync(_self);
+pl_readline_fuzzy_t pl_readline_dict_version_fuzzy(pl_readline_dict_version_t version);
+#endif
 #if PL_ENABLE_HISTORY_FILE
     void pl_readline_save_history(_self, const char *filename);
 void pl_readline_load_history(_self, const char *filename);
+int  pl_readline_save_history_as(_self, const char *filename, int format);
+int  pl_readline_history_convert(const char *from, const char *to, int format);
+bool pl_readline_history_may_contain(pl_readline_history_t history, const char *word, usize len);
+#    if PL_ENABLE_POSIX
+int  pl_readline_history_open(_self, const char *filename);
+void pl_readline_history_close(_self);
+int  pl_readline_history_sync(_self);
+int  pl_readline_history_compact(_self);
+void pl_readline_history_append(_self, const char *line, usize len);
+void pl_readline_history_tick(_self);
+usize pl_readline_history_file_memory(_self);
+int  pl_readline_history_share(_self, bool enable);
+void pl_readline_history_refresh(_self);
+#    endif
 #endif
 
 #endif /* PL_READLINE_H */
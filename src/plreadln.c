@@ -18,147 +18,211 @@ pl_readline_t
 pl_readline_init(int (*pl_readline_hal_getch)(void), int (*pl_readline_hal_putch)(int ch),
                  void (*pl_readline_hal_flush)(void),
                  void (*pl_readline_get_words)(char *buf, pl_readline_words_t words)) {
-    pl_readline_t plreadln = malloc(sizeof(struct pl_readline));
+    pl_readline_t plreadln = calloc(1, sizeof(struct pl_readline));
     if (!plreadln) return NULL;
     // 设置回调函数
     plreadln->pl_readline_hal_getch = pl_readline_hal_getch;
     plreadln->pl_readline_hal_putch = pl_readline_hal_putch;
     plreadln->pl_readline_hal_flush = pl_readline_hal_flush;
     plreadln->pl_readline_get_words = pl_readline_get_words;
-    // 设置history链表
-    plreadln->history = NULL;
+    plreadln->pl_readline_hal_write = NULL; // 可选，由调用者自行设置
+    plreadln->pl_readline_hal_read  = NULL; // 可选，设置后代替pl_readline_hal_getch
+    plreadln->pl_readline_get_words_async = NULL; // 可选，设置后代替pl_readline_get_words
+    plreadln->completion_timeout          = PL_READLINE_COMPLETION_TIMEOUT;
+    // 设置历史记录
+    plreadln->history = pl_readline_history_new(PL_READLINE_HISTORY_MAX);
     plreadln->maxlen  = PL_READLINE_DEFAULT_BUFFER_LEN;
-    // 设置输入缓冲区
-    plreadln->buffer    = malloc(plreadln->maxlen);
-    plreadln->input_buf = malloc(plreadln->maxlen);
+    // 设置输入缓冲区（候选词列表第一次用到时才创建）
+    plreadln->buffer = malloc(plreadln->maxlen);
 
-    // 设置着色
-    plreadln->color_words = NULL;
-    plreadln->color_max_words = 256; // 默认最多256个词组
-    if (!plreadln->buffer || !plreadln->input_buf) {
+    if (!plreadln->buffer || !plreadln->history) {
         pl_readline_uninit(plreadln);
         return NULL;
     }
-    pl_readline_add_history(plreadln, "");
     return plreadln;
 }
 
 void pl_readline_uninit(_self) {
-    list_free_with(self->history, free);
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    pl_readline_history_close(self);
+#endif
+#if PL_ENABLE_SHARED_DICT
+    pl_readline_attach_dict(self, NULL); // 摘下共用的词库
+#endif
+#if PL_ENABLE_ASYNC_COMPLETION
+    pl_readline_async_cancel(self);
+#endif
+    pl_readline_search_free(self); // 索引可能还留着历史记录里的字符串，先放掉
+    pl_readline_prefix_free(self);
+    pl_readline_history_free(self->history);
+    free(self->history_line);
     free(self->buffer);
-    free(self->input_buf);
-    if(self->color_words) {
-        free(self->color_words);
-    }
+    free(self->out_buf);
+    free(self->frame);
+    free(self->paste);
+    free(self->in_buf);
+    free(self->tokens);
+    free(self->token_scratch);
+    pl_readline_color_cache_free(self);
+    pl_readline_spans_free(self);
+    pl_readline_dict_free(self->dict);
+    free(self->annotation);
+    free(self->intellisense_word);
+    free(self->stats);
+    if (self->words) pl_readline_word_maker_destroy(self->words);
+    if (self->words_temp) pl_readline_word_maker_destroy(self->words_temp);
+    pl_readline_candidates_free(self);
+    pl_readline_fuzzy_free(self);
     free(self);
 }
-static void pl_readline_reset(_self, int p, int len) {
-    char buf[255] = {0};
-    if (p) {
-        sprintf(buf, "\033[%dD", p);
-        pl_readline_print(self, buf);
-    }
-    if (len) {
-        for (int i = 0; i < len; i++) {
-            self->pl_readline_hal_putch(' ');
-        }
-        sprintf(buf, "\033[%dD", len);
-        pl_readline_print(self, buf);
-    }
+// 处理向上向下键（移动到倒数第n个历史，0为输入行）
+static bool pl_readline_handle_history(_self, int n) {
+    usize count = pl_readline_history_count(self->history);
+    usize len   = 0;
+    if (n < 0 || (usize)n > count) return false;
+    const char *line = n ? pl_readline_history_get(self->history, count - n, &len)
+                         : (self->history_line ? self->history_line : "");
+    if (!n && self->history_line) len = strlen(self->history_line);
+    if (!pl_readline_buffer_set(self, line, len)) return false;
+    self->ptr = self->length;
+    redisplay_buffer_with_colors(self, 0);
+    return true;
 }
 
-static void pl_readline_to_the_end(_self, int n) {
-    char buf[255] = {0};
-    sprintf(buf, "\033[%dC", n);
-    pl_readline_print(self, buf);
+void pl_readline_insert_char_and_view(_self, char ch) {
+    if (!pl_readline_buffer_insert(self, self->ptr, &ch, 1)) return; // 炸了算了
+    self->ptr++;
+
+    // Use colorized redisplay for all edits
+    redisplay_buffer_with_colors(self, 0); // Don't show prompt during edit
 }
-// 处理向上向下键（移动到第n个历史）
-static bool pl_readline_handle_history(_self, int n) {
-    list_t node = list_nth(self->history, n); // 获取历史记录
-    if (!node) return false;
-    pl_readline_reset(self, self->ptr, self->length); // 重置光标和输入的字符
-    self->pl_readline_hal_flush();         // 刷新输出缓冲区，在Linux下需要,否则会导致输入不显示
-    self->ptr    = 0;                      // 光标移动到最左边
-    self->length = 0;                      // 清空缓冲区长度
-    memset(self->buffer, 0, self->maxlen); // 清空缓冲区
-    while (strlen(node->data) + 1 >= (unsigned long)self->maxlen) {
-        self->maxlen *= 2; // 如果历史记录过长，扩大缓冲区
-        self->buffer     = realloc(self->buffer, self->maxlen);
-        self->input_buf  = realloc(self->input_buf, self->maxlen);
-        if (!self->buffer || !self->input_buf) return false; // 分配失败
-    }
-    strcpy(self->buffer, node->data);
-    pl_readline_print(self, self->buffer); // 打印历史记录
-    self->length = strlen(self->buffer);   // 更新缓冲区长度
-    self->ptr    = self->length;
 
-    memset(self->input_buf, 0, self->maxlen); // 清空输入缓冲区
-    self->input_ptr = 0;                      // 输入缓冲区指针置0
-    char *p         = node->data;
-    while (*p) {
-        if (*p == ' ') {
-            self->input_ptr = 0;
-            p++;
-            continue;
-        }
-        self->input_buf[self->input_ptr++] = *p++;
+// 一次性插入一段文本，只做一次拼接和一次重绘
+void pl_readline_insert_string(_self, const char *str, size_t len) {
+    if (!len || !pl_readline_buffer_reserve(self, len)) return;
+    pl_readline_buffer_move_gap(self, self->ptr);
+    // 直接写进间隙里：换行、制表符变成空格，其它控制字符丢掉
+    char *dst = self->buffer + self->gap;
+    isize n   = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = str[i];
+        if (ch == '\n' || ch == '\r' || ch == '\t') ch = ' ';
+        if (ch < ' ' || ch == 0x7f) continue;
+        dst[n++] = ch;
     }
-    self->input_buf[self->input_ptr] = '\0';
-    self->input_ptr                  = strlen(self->input_buf); // 更新输入缓冲区指针
-
+    self->gap    += n;
+    self->length += n;
+    pl_readline_tokens_update(self, self->ptr, 0, n);
+    self->ptr += n;
     redisplay_buffer_with_colors(self, 0);
-    return true;
 }
 
-void pl_readline_insert_char_and_view(_self, char ch) {
-    if (self->length + 1 >= self->maxlen) {
-        self->maxlen *= 2;
-        self->buffer                = realloc(self->buffer, self->maxlen);
-        self->input_buf             = realloc(self->input_buf, self->maxlen);
-        self->buffer[self->length]  = '\0';
-        if (!self->buffer) return; // 炸了算了
+struct pl_readline_paste {
+    usize len;    // 粘贴内容长度
+    usize cap;    // data的容量
+    char  data[]; // 粘贴内容
+};
+
+// 括号粘贴模式下收集粘贴的内容
+static void pl_readline_paste_char(_self, char ch) {
+    pl_readline_paste_t paste = self->paste;
+    if (paste->len == paste->cap) {
+        usize cap = paste->cap * 2;
+        paste     = realloc(paste, sizeof(struct pl_readline_paste) + cap);
+        if (!paste) return;
+        paste->cap  = cap;
+        self->paste = paste;
     }
-    pl_readline_insert_char(self->buffer, ch, self->ptr++);
-    self->length++;
+    paste->data[paste->len++] = ch;
+}
 
-    // Use colorized redisplay for all edits
-    redisplay_buffer_with_colors(self, 0); // Don't show prompt during edit
+// 括号粘贴开始，分配失败时粘贴的内容按普通按键处理
+static void pl_readline_paste_start(_self) {
+    if (self->paste) return;
+    self->paste = malloc(sizeof(struct pl_readline_paste) + 256);
+    if (!self->paste) return;
+    self->paste->len = 0;
+    self->paste->cap = 256;
+}
+
+// 括号粘贴结束（或者一行已经结束），不再需要缓冲区
+static void pl_readline_paste_end(_self) {
+    free(self->paste);
+    self->paste = NULL;
+}
+
+// 粘贴缓冲区占用的内存（字节）
+usize pl_readline_paste_memory(_self) {
+    return self->paste ? sizeof(struct pl_readline_paste) + self->paste->cap : 0;
 }
 
 void pl_readline_next_line(_self) {
-    int  n        = self->length - self->ptr;
-    char buf[255] = {0};
-    if (!n) {
+    pl_readline_move_cursor(self, self->frame_len); // 光标移动到最右边
+    pl_readline_print(self, "\n");
+}
+
+// 补全并显示结果；fetch为false时候选词已经由异步请求放进了 self->words
+void pl_readline_complete(_self, bool fetch) {
+    if (!pl_readline_word_maker_get(&self->words)) return;
+    pl_readline_suggest_enable(self, false); // 列出候选词之前擦掉建议
+    pl_readline_word word_seletion;
+    if (self->fuzzy_mode) {
+        word_seletion = pl_readline_intellisense_fuzzy(self, self->words, fetch);
+    } else if (!fetch) {
+        word_seletion = pl_readline_intellisense_ready(self, self->words);
+    } else {
+        word_seletion = pl_readline_intellisense(self, self->words);
+    }
+    pl_readline_suggest_enable(self, true);
+    if (word_seletion.word) {
+        // pl_readline_intellisense_insert会释放word_seletion.word
+        pl_readline_intellisense_insert(self, word_seletion);
+        // Redisplay with colors after completion but don't show prompt
+        redisplay_buffer_with_colors(self, 0);
+    } else if (word_seletion.first) {
         pl_readline_print(self, "\n");
-        return;
+        pl_readline_print(self, self->prompt);
+        pl_readline_frame_reset(self);
+
+        // Use colorized display without showing prompt since we printed it already
+        redisplay_buffer_with_colors(self, 0);
+    } else {
+        redisplay_buffer_with_colors(self, 0); // 把擦掉的建议画回来
     }
-    sprintf(buf, "\033[%dC", n); // 光标移动到最右边
-    pl_readline_print(self, buf);
-    pl_readline_print(self, "\n");
 }
 
 // 处理输入的字符
-int pl_readline_handle_key(_self, int ch) {
+static int pl_readline_handle_key_inner(_self, int ch) {
     if (ch != PL_READLINE_KEY_TAB) {
         self->intellisense_mode = false;
         if (self->intellisense_word) {
             free(self->intellisense_word);
             self->intellisense_word = NULL;
         }
+#if PL_ENABLE_ASYNC_COMPLETION
+        pl_readline_async_cancel(self); // 输入变了，等待中的补全结果过时了
+#endif
     }
-    if (self->length + 1 >= self->maxlen) {
-        self->maxlen *= 2;
-        self->buffer                = realloc(self->buffer, self->maxlen);
-        self->input_buf             = realloc(self->input_buf, self->maxlen);
-        self->buffer[self->length]  = '\0'; // input_buf在处理时会自动截断 不用我们加
-        if (!self->buffer) return PL_READLINE_FAILED;
+    if (self->paste) { // 粘贴的内容攒到结束标记再一起插入
+        if (ch == PL_READLINE_KEY_PASTE_END) {
+            pl_readline_paste_t paste = self->paste;
+            self->paste               = NULL;
+            pl_readline_insert_string(self, paste->data, paste->len);
+            free(paste);
+        } else if (ch >= 0 && ch < 0xff00) {
+            pl_readline_paste_char(self, ch);
+        }
+        return PL_READLINE_NOT_FINISHED;
     }
+    if (pl_readline_search_key(self, ch)) return PL_READLINE_NOT_FINISHED; // 历史搜索
     switch (ch) {
     case PL_READLINE_KEY_DOWN:
+        if (pl_readline_prefix_down(self)) break; // 按输入行的前缀翻看
         pl_readline_modify_history(self);
         if (pl_readline_handle_history(self, self->history_idx - 1)) self->history_idx--;
         break;
     case PL_READLINE_KEY_UP: {
+        if (pl_readline_prefix_up(self)) break;
         pl_readline_modify_history(self);
         if (pl_readline_handle_history(self, self->history_idx + 1)) self->history_idx++;
         break;
@@ -167,190 +231,222 @@ int pl_readline_handle_key(_self, int ch) {
         if (!self->ptr) // 光标在最左边
             return PL_READLINE_NOT_FINISHED;
         self->ptr--;
-        if (self->buffer[self->ptr] == ' ') {
-            memset(self->input_buf, 0, self->maxlen);
-            // 光标移动到前一个空格
-            isize i = self->ptr;
-            while (i && self->buffer[i - 1] != ' ') {
-                i--;
-            }
-            self->input_ptr = 0;
-            // 从i开始复制到self->input_buf，直到遇到空格
-            while (i < self->ptr && self->buffer[i] != ' ') {
-                self->input_buf[self->input_ptr++] = self->buffer[i];
-                i++;
-            }
-            // 字符串结束符号
-            self->input_buf[self->input_ptr] = '\0';
-        } else {
-            self->input_ptr--;
-        }
-
-        // Redraw the line with updated coloring
         redisplay_buffer_with_colors(self, 0);
         break;
     case PL_READLINE_KEY_RIGHT:
-        if (self->ptr == self->length) // 光标在最右边
+        if (pl_readline_suggest_accept(self)) break; // 接受历史记录的建议
+        if (self->ptr == self->length)               // 光标在最右边
             return PL_READLINE_NOT_FINISHED;
         self->ptr++;
-        if (self->buffer[self->ptr - 1] == ' ') {
-            memset(self->input_buf, 0, self->maxlen);
-            // 光标移动到前一个空格
-            isize i = self->ptr;
-            isize j = i;
-            while (i < self->length && self->buffer[i + 1] != ' ') {
-                i++;
-            }
-            self->input_ptr = 0;
-            // 从i开始复制到self->input_buf，直到遇到空格
-            while (j <= i && self->buffer[i] != ' ') {
-                self->input_buf[self->input_ptr++] = self->buffer[j];
-                j++;
-            }
-            // 字符串结束符号
-            self->input_buf[self->input_ptr] = '\0';
-            self->input_ptr                  = 0;
-        } else {
-            self->input_ptr++;
-        }
-
-        // Redraw the line with updated coloring
         redisplay_buffer_with_colors(self, 0);
         break;
     case PL_READLINE_KEY_BACKSPACE:
         if (!self->ptr) // 光标在最左边
             return PL_READLINE_NOT_FINISHED;
-        --self->ptr;
-        if (self->buffer[self->ptr] == ' ') {
-            memset(self->input_buf, 0, self->maxlen);
-            // 光标移动到前一个空格
-            isize i = self->ptr;
-            while (i && self->buffer[i - 1] != ' ') {
-                i--;
-            }
-            self->input_ptr = 0;
-            // 从i开始复制到self->input_buf，直到遇到空格
-            while (i < self->ptr && self->buffer[i] != ' ') {
-                self->input_buf[self->input_ptr++] = self->buffer[i];
-                i++;
-            }
-            // 字符串结束符号
-            self->input_buf[self->input_ptr] = '\0';
-        } else {
-            if (self->input_ptr) pl_readline_delete_char(self->input_buf, --self->input_ptr);
-        }
-        pl_readline_delete_char(self->buffer, self->ptr);
-
-        self->length--;
+        pl_readline_buffer_delete(self, --self->ptr, 1);
 
         // Redraw the entire line with updated colors
         redisplay_buffer_with_colors(self, 0);
         break;
     case PL_READLINE_KEY_ENTER:
-        pl_readline_to_the_end(self, self->length - self->ptr);
-        self->pl_readline_hal_putch('\n');
-        self->buffer[self->length] = '\0';
-        self->history_idx          = 0;
-        pl_readline_modify_history(self);
-        if (self->buffer[0] != '\0') { pl_readline_add_history(self, ""); }
+        pl_readline_suggest_enable(self, false); // 先擦掉建议，光标才会停在输入内容后面
+        pl_readline_next_line(self);
+        self->history_idx = 0;
+        if (self->length) { pl_readline_add_history(self, pl_readline_buffer_view(self)); }
         return PL_READLINE_SUCCESS;
-    case PL_READLINE_KEY_TAB: { // 自动补全
-        // **NOTE**: words 在 pl_readline_intellisense 会被destory
-        pl_readline_words_t words         = pl_readline_word_maker_init();
-        pl_readline_word    word_seletion = pl_readline_intellisense(self, words);
-        if (word_seletion.word) {
-            // pl_readline_intellisense_insert会释放word_seletion.word
-            pl_readline_intellisense_insert(self, word_seletion);
-            // Redisplay with colors after completion but don't show prompt
-            redisplay_buffer_with_colors(self, 0);
-            self->pl_readline_hal_flush();
-        } else if (word_seletion.first) {
-            pl_readline_print(self, "\n");
-            pl_readline_print(self, self->prompt);
-            self->buffer[self->length] = '\0';
-
-            // Use colorized display without showing prompt since we printed it already
-            redisplay_buffer_with_colors(self, 0);
-
-            self->pl_readline_hal_flush();
-        }
+    case PL_READLINE_KEY_TAB: // 自动补全
+#if PL_ENABLE_ASYNC_COMPLETION
+        if (pl_readline_async_start(self)) break; // 候选词到齐或者超时之后再显示
+#endif
+        pl_readline_complete(self, true);
         break;
-    }
     case PL_READLINE_KEY_CTRL_A:
     case PL_READLINE_KEY_HOME:
-        pl_readline_reset(self, self->ptr, 0);
         self->ptr = 0;
-        int i     = 0;
-        for (i = 0; self->buffer[i] != '\0' && self->buffer[i] != ' '; i++) {
-            self->input_buf[i] = self->buffer[i];
-        }
-        self->input_buf[i] = '\0';
-        self->input_ptr    = 0;
+        redisplay_buffer_with_colors(self, 0);
         break;
-    case PL_READLINE_KEY_END: {
-        size_t diff = self->length - self->ptr;
-        if (diff) {
-            pl_readline_to_the_end(self, self->length - self->ptr);
-            self->ptr = self->length;
-        }
+    case PL_READLINE_KEY_WORD_LEFT:
+        self->ptr = pl_readline_word_left(self);
+        redisplay_buffer_with_colors(self, 0);
+        break;
+    case PL_READLINE_KEY_WORD_RIGHT:
+        self->ptr = pl_readline_word_right(self);
+        redisplay_buffer_with_colors(self, 0);
+        break;
+    case PL_READLINE_KEY_END:
+        if (pl_readline_suggest_accept(self)) break;
+        self->ptr = self->length;
+        redisplay_buffer_with_colors(self, 0);
         break;
-    }
     case PL_READLINE_KEY_PAGE_UP: {
-        size_t len = list_length(self->history);
+        int oldest = pl_readline_history_count(self->history);
         pl_readline_modify_history(self);
-        pl_readline_handle_history(self, len - 1);
-        self->history_idx = len - 1;
+        if (pl_readline_handle_history(self, oldest)) self->history_idx = oldest;
         break;
     }
     case PL_READLINE_KEY_PAGE_DOWN:
         pl_readline_modify_history(self);
-        pl_readline_handle_history(self, 0);
-        self->history_idx = 0;
+        if (pl_readline_handle_history(self, 0)) self->history_idx = 0;
+        break;
+    case PL_READLINE_KEY_PASTE_START: pl_readline_paste_start(self); break;
+    case PL_READLINE_KEY_PASTE_END:
+    case PL_READLINE_KEY_CTRL_G:
         break;
     case PL_READLINE_KEY_CTRL_C:
-        self->buffer[0] = '\0';
+        pl_readline_suggest_enable(self, false);
+        pl_readline_buffer_clear(self);
         pl_readline_print(self, "^C\n");
         return PL_READLINE_SUCCESS;
-    case ' ': {
-        memset(self->input_buf, 0, self->maxlen);
-        self->input_ptr = 0;
-        goto handle;
-    }
-    default: {
-        pl_readline_insert_char(self->input_buf, ch, self->input_ptr++);
-    handle:
+    default:
+        if (ch < 0) break; // 读取失败或不认识的按键
         pl_readline_insert_char_and_view(self, ch);
         break;
     }
-    }
     return PL_READLINE_NOT_FINISHED;
 }
 
-// 主体函数
-const char *pl_readline(_self, char *prompt) {
-    // 清空运行时状态
-    memset(self->buffer, 0, self->maxlen);
-    memset(self->input_buf, 0, self->maxlen);
-    self->input_ptr         = 0;
+// 一次按键的所有输出都先进入输出缓冲区，最外层结束时只刷新一次
+int pl_readline_handle_key(_self, int ch) {
+    usize calls = self->stats ? self->stats->write_calls : 0;
+    usize bytes = self->stats ? self->stats->write_bytes : 0;
+#if PL_ENABLE_SHARED_DICT
+    if (!self->key_depth) pl_readline_dict_sync(self); // 一次按键之内只用同一个版本的词库
+#endif
+    self->key_depth++;
+    int status = pl_readline_handle_key_inner(self, ch);
+    if (--self->key_depth == 0) {
+        pl_readline_flush(self);
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+        pl_readline_history_tick(self);
+#endif
+        if (self->stats) {
+            self->stats->keys++;
+            self->stats->last_write_calls = self->stats->write_calls - calls;
+            self->stats->last_write_bytes = self->stats->write_bytes - bytes;
+        }
+    }
+    return status;
+}
+
+// 清空运行时状态并打印提示符，之后就可以接收按键了
+void pl_readline_begin(_self, char *prompt) {
+    pl_readline_buffer_clear(self);
+    if (self->history_line) self->history_line[0] = '\0'; // 缓冲区留着下次用
     self->ptr               = 0;
-    self->length            = 0;
     self->history_idx       = 0;
     self->prompt            = prompt;
     self->intellisense_mode = false;
     self->intellisense_word = NULL;
+    self->annotation_len    = 0;
+    self->reading           = true;
+    self->line_ready        = false;
+    pl_readline_paste_end(self);
+    pl_readline_trim_line(self); // 上一行留下的大块内存
+    pl_readline_suggest_enable(self, true);
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    pl_readline_history_refresh(self); // 共享模式下合并别的会话新加的历史记录
+#endif
+#if PL_ENABLE_SHARED_DICT
+    pl_readline_dict_sync(self);
+#endif
 
     // 打印提示符
     pl_readline_print(self, prompt);
+    if (self->bracketed_paste) pl_readline_print(self, "\033[?2004h"); // 打开终端的括号粘贴模式
+    pl_readline_frame_reset(self);
     // 刷新输出缓冲区，在Linux下需要,否则会导致输入不显示
-    self->pl_readline_hal_flush();
+    pl_readline_flush(self);
+}
+
+// 一行输入结束了
+static void pl_readline_end(_self) {
+    if (self->intellisense_word) { free(self->intellisense_word); }
+    self->intellisense_word = NULL;
+    self->reading           = false;
+#if PL_ENABLE_ASYNC_COMPLETION
+    pl_readline_async_cancel(self); // 这一行已经结束，不再需要补全结果
+#endif
+    if (self->bracketed_paste) {
+        pl_readline_print(self, "\033[?2004l");
+        pl_readline_flush(self);
+    }
+}
+
+// 送入一批原始字节（可以只是一个转义序列的一部分），解码并处理其中的按键，
+// 输出在这批字节处理完后一次刷新。一行结束时返回 PL_READLINE_SUCCESS，
+// 剩下的字节留给下一行：pl_readline_begin 之后用 pl_readline_feed(self, NULL, 0) 处理它们
+int pl_readline_feed(_self, const char *bytes, usize len) {
+    if (!self->reading) return PL_READLINE_FAILED;
+    bool queued = self->in_pos < self->in_len; // 还有上一行剩下的字节，接在它们后面
+    if (queued) {
+        if (!pl_readline_input_append(self, bytes, len)) return PL_READLINE_FAILED;
+        bytes = self->in_buf + self->in_pos;
+        len   = self->in_len - self->in_pos;
+    }
+    usize calls  = self->stats ? self->stats->write_calls : 0;
+    usize nbytes = self->stats ? self->stats->write_bytes : 0;
+    usize used   = 0;
+    int   status = PL_READLINE_NOT_FINISHED;
+#if PL_ENABLE_SHARED_DICT
+    if (!self->key_depth) pl_readline_dict_sync(self);
+#endif
+    self->key_depth++;
+#if PL_ENABLE_ASYNC_COMPLETION
+    pl_readline_poll(self); // 先显示已经到齐的补全结果，再处理之后的按键
+#endif
+    while (used < len && status != PL_READLINE_SUCCESS) {
+        int key = pl_readline_decode(&self->decoder, (unsigned char)bytes[used++]);
+        if (key < 0) continue;
+        status = pl_readline_handle_key(self, key);
+        if (self->stats) self->stats->keys++;
+    }
+    if (status == PL_READLINE_SUCCESS) {
+        pl_readline_end(self);
+        self->line_ready = true;
+    }
+    if (--self->key_depth == 0) {
+        pl_readline_flush(self);
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+        pl_readline_history_tick(self);
+#endif
+        if (self->stats) {
+            self->stats->last_write_calls = self->stats->write_calls - calls;
+            self->stats->last_write_bytes = self->stats->write_bytes - nbytes;
+        }
+    }
+    if (queued) {
+        self->in_pos += used;
+    } else if (used < len && !pl_readline_input_append(self, bytes + used, len - used)) {
+        return PL_READLINE_FAILED;
+    }
+    return status;
+}
+
+// 取走 pl_readline_feed 完成的一行，没有时返回NULL；在下一次 pl_readline_begin 之前有效
+const char *pl_readline_take_line(_self) {
+    if (!self->line_ready) return NULL;
+    self->line_ready = false;
+    return pl_readline_buffer_view(self);
+}
+
+// 主体函数，输入结束或读取失败时返回NULL
+const char *pl_readline(_self, char *prompt) {
+    pl_readline_begin(self, prompt);
 
     // 循环读取输入
     while (true) {
-        int ch     = self->pl_readline_hal_getch(); // 读取输入
+#if PL_ENABLE_ASYNC_COMPLETION
+        if (self->in_pos == self->in_len) pl_readline_async_wait(self); // 还有没处理的按键时不用等
+#endif
+        int ch = pl_readline_read_key(self); // 读取输入
+        if (ch < 0) {                        // 输入已经结束（或出错），不能再等下去了
+            pl_readline_end(self);
+            return NULL;
+        }
         int status = pl_readline_handle_key(self, ch);
         if (status == PL_READLINE_SUCCESS) { break; }
     }
 
-    if (self->intellisense_word) { free(self->intellisense_word); }
-    return self->buffer;
+    pl_readline_end(self);
+    return pl_readline_buffer_view(self);
 }
@@ -0,0 +1,191 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_async.c : 异步补全
+//
+// 设置了 pl_readline_get_words_async 时，按tab只是发出一个请求，提供者在别的线程里慢慢给出候选词，
+// 编辑器照常接收按键。请求完成，或者等到了期限（只显示已经给出的部分），才显示补全的结果。
+// 请求之后的任何按键（包括再按一次tab）都会取消它，提供者可以用 pl_readline_request_cancelled 提前收工。
+//
+// 请求由编辑器和提供者各持有一个引用，编辑器取消、提供者完成都只是放掉自己的那个，
+// 所以谁先谁后都没有关系。
+
+#include "pl_readline.h"
+
+#if PL_ENABLE_ASYNC_COMPLETION
+#    include <pthread.h>
+#    include <time.h>
+
+struct pl_readline_request {
+    pthread_mutex_t     lock;
+    pthread_cond_t      done;      // 完成时通知
+    pl_readline_words_t words;     // 已经给出的候选词
+    char               *word;      // 要补全的前缀
+    uint64_t            deadline;  // 到这个时间（毫秒，单调时钟）就不再等了，只有编辑器读写
+    bool                cancelled; // 编辑器不再需要结果
+    bool                finished;  // 提供者调用了 pl_readline_request_finish
+    int                 refs;
+};
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static pl_readline_request_t request_new(char *word) {
+    pl_readline_request_t req = calloc(1, sizeof(struct pl_readline_request));
+    if (!req) return NULL;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // 期限按单调时钟计算
+    bool ok = !pthread_mutex_init(&req->lock, NULL);
+    if (ok && pthread_cond_init(&req->done, &attr)) {
+        pthread_mutex_destroy(&req->lock);
+        ok = false;
+    }
+    pthread_condattr_destroy(&attr);
+    if (ok && !(req->words = pl_readline_word_maker_init())) {
+        pthread_cond_destroy(&req->done);
+        pthread_mutex_destroy(&req->lock);
+        ok = false;
+    }
+    if (!ok) {
+        free(req);
+        return NULL;
+    }
+    req->word = word;
+    req->refs = 2; // 编辑器和提供者
+    return req;
+}
+
+// 放掉一个引用，调用者持有锁
+static void request_release_locked(pl_readline_request_t req) {
+    if (--req->refs) {
+        pthread_mutex_unlock(&req->lock);
+        return;
+    }
+    pthread_mutex_unlock(&req->lock);
+    pthread_mutex_destroy(&req->lock);
+    pthread_cond_destroy(&req->done);
+    pl_readline_word_maker_destroy(req->words);
+    free(req->word);
+    free(req);
+}
+
+const char *pl_readline_request_word(pl_readline_request_t req) {
+    return req->word;
+}
+
+bool pl_readline_request_cancelled(pl_readline_request_t req) {
+    pthread_mutex_lock(&req->lock);
+    bool cancelled = req->cancelled;
+    pthread_mutex_unlock(&req->lock);
+    return cancelled;
+}
+
+// 给出一个候选词（word会被复制），可以在任何线程调用；请求已经取消时返回 PL_READLINE_FAILED
+int pl_readline_request_add(pl_readline_request_t req, const char *word, bool first, int color,
+                            char sep) {
+    pthread_mutex_lock(&req->lock);
+    int ret = PL_READLINE_FAILED;
+    if (!req->cancelled && !req->finished) {
+        ret = pl_readline_word_maker_add((char *)word, req->words, first, color, sep);
+    }
+    pthread_mutex_unlock(&req->lock);
+    return ret;
+}
+
+// 候选词给完了，之后不能再使用req；取消了的请求也要调用
+void pl_readline_request_finish(pl_readline_request_t req) {
+    pthread_mutex_lock(&req->lock);
+    req->finished = true;
+    pthread_cond_signal(&req->done);
+    request_release_locked(req);
+}
+
+void pl_readline_set_completion_timeout(_self, int ms) {
+    self->completion_timeout = ms < 0 ? 0 : ms;
+}
+
+void pl_readline_async_cancel(_self) {
+    pl_readline_request_t req = self->pending;
+    if (!req) return;
+    self->pending = NULL;
+    pthread_mutex_lock(&req->lock);
+    req->cancelled = true;
+    request_release_locked(req);
+}
+
+// 请求完成或者过了期限时，把给出的候选词取到 self->words 里并结束请求
+static bool take_words(_self) {
+    pl_readline_request_t req = self->pending;
+    pthread_mutex_lock(&req->lock);
+    if (!req->finished && now_ms() < req->deadline) {
+        pthread_mutex_unlock(&req->lock);
+        return false;
+    }
+    pl_readline_words_t words = pl_readline_word_maker_get(&self->words);
+    if (words) pl_readline_word_maker_clear(words);
+    for (isize i = 0; words && i < req->words->len; i++) {
+        const pl_readline_word *w = &req->words->words[i];
+        pl_readline_word_maker_add(w->word, words, w->first, w->color, w->sep);
+    }
+    pthread_mutex_unlock(&req->lock);
+    pl_readline_async_cancel(self); // 没完成的部分不要了
+    return true;
+}
+
+// 按tab时发出请求，没有设置异步的提供者时返回false
+bool pl_readline_async_start(_self) {
+    if (!self->pl_readline_get_words_async) return false;
+    pl_readline_async_cancel(self); // 上一次tab的请求过时了
+    char                 *word = pl_readline_completion_word(self);
+    pl_readline_request_t req  = word ? request_new(word) : NULL;
+    if (!req) {
+        free(word);
+        return true; // 内存不足，这次tab什么也不做
+    }
+    req->deadline = now_ms() + self->completion_timeout;
+    self->pending = req;
+    self->pl_readline_get_words_async(req);
+    pl_readline_poll(self); // 提供者可能当场就给完了
+    return true;
+}
+
+// 看看等待中的补全请求：完成了或者过了期限就显示结果。
+// 返回离期限还有多少毫秒（事件循环最多等这么久就该再调用一次），没有等待中的请求时返回-1
+int pl_readline_poll(_self) {
+    if (!self->pending) return -1;
+    if (!take_words(self)) {
+        uint64_t now = now_ms();
+        return now < self->pending->deadline ? (int)(self->pending->deadline - now) : 0;
+    }
+    pl_readline_complete(self, false);
+    if (!self->key_depth) pl_readline_flush(self); // 不在按键处理之中，自己刷新
+    return -1;
+}
+
+// 阻塞读取按键时没法一边等一边接收按键，在读取之前最多等到期限
+void pl_readline_async_wait(_self) {
+    pl_readline_request_t req = self->pending;
+    if (!req) return;
+    struct timespec deadline = {
+        .tv_sec  = req->deadline / 1000,
+        .tv_nsec = req->deadline % 1000 * 1000000,
+    };
+    pthread_mutex_lock(&req->lock);
+    while (!req->finished) {
+        if (pthread_cond_timedwait(&req->done, &req->lock, &deadline)) break;
+    }
+    pthread_mutex_unlock(&req->lock);
+    pl_readline_poll(self);
+}
+#endif
@@ -0,0 +1,101 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_buffer.c : 输入行的间隙缓冲区（gap buffer）
+//
+// 文本分成两段存放：[0, gap) 是间隙前的部分，间隙后的部分紧贴在存储区末尾。
+// 编辑总是发生在光标附近，把间隙移动到光标处之后插入和删除都是 O(1)。
+// 需要连续的字符串时（补全、历史、返回结果）再把间隙挪到末尾。
+
+#include "pl_readline.h"
+#include <string.h>
+
+// 间隙的大小
+#define GAP_SIZE(self) ((self)->maxlen - (self)->length)
+
+void pl_readline_buffer_move_gap(_self, isize pos) {
+    isize gap_size = GAP_SIZE(self);
+    if (pos < self->gap) {
+        memmove(self->buffer + pos + gap_size, self->buffer + pos, self->gap - pos);
+    } else if (pos > self->gap) {
+        memmove(self->buffer + self->gap, self->buffer + self->gap + gap_size, pos - self->gap);
+    }
+    self->gap = pos;
+}
+
+bool pl_readline_buffer_reserve(_self, isize extra) {
+    // 始终保留一个字节给结束符
+    if (self->length + extra + 1 <= self->maxlen) return true;
+    isize maxlen = self->maxlen ? self->maxlen : PL_READLINE_DEFAULT_BUFFER_LEN;
+    while (self->length + extra + 1 > maxlen) {
+        maxlen *= 2;
+    }
+    char *buffer = realloc(self->buffer, maxlen);
+    if (!buffer) return false;
+    // 间隙后的部分搬到新的末尾
+    isize tail = self->length - self->gap;
+    memmove(buffer + maxlen - tail, buffer + self->maxlen - tail, tail);
+    self->buffer = buffer;
+    self->maxlen = maxlen;
+    return true;
+}
+
+bool pl_readline_buffer_insert(_self, isize pos, const char *str, isize len) {
+    if (!pl_readline_buffer_reserve(self, len)) return false;
+    pl_readline_buffer_move_gap(self, pos);
+    memcpy(self->buffer + self->gap, str, len);
+    self->gap    += len;
+    self->length += len;
+    pl_readline_tokens_update(self, pos, 0, len);
+    return true;
+}
+
+void pl_readline_buffer_delete(_self, isize pos, isize len) {
+    pl_readline_buffer_move_gap(self, pos);
+    self->length -= len; // 间隙向后扩大，吞掉被删除的字符
+    pl_readline_tokens_update(self, pos, len, 0);
+}
+
+char pl_readline_buffer_at(_self, isize idx) {
+    return idx < self->gap ? self->buffer[idx] : self->buffer[idx + GAP_SIZE(self)];
+}
+
+void pl_readline_buffer_copy(_self, isize from, isize to, char *dst) {
+    if (from < self->gap) {
+        isize n = (to < self->gap ? to : self->gap) - from;
+        memcpy(dst, self->buffer + from, n);
+        dst  += n;
+        from += n;
+    }
+    if (from < to) memcpy(dst, self->buffer + from + GAP_SIZE(self), to - from);
+}
+
+char *pl_readline_buffer_view(_self) {
+    pl_readline_buffer_move_gap(self, self->length);
+    self->buffer[self->length] = '\0';
+    return self->buffer;
+}
+
+void pl_readline_buffer_clear(_self) {
+    self->gap    = 0;
+    self->length = 0;
+    pl_readline_tokens_reset(self);
+    pl_readline_spans_reset(self);
+}
+
+bool pl_readline_buffer_set(_self, const char *str, isize len) {
+    pl_readline_buffer_clear(self);
+    if (!pl_readline_buffer_reserve(self, len)) return false;
+    memcpy(self->buffer, str, len);
+    self->gap    = len;
+    self->length = len;
+    pl_readline_tokens_update(self, 0, 0, len);
+    return true;
+}
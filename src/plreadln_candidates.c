@@ -0,0 +1,114 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_candidates.c : 在上一次的候选词里缩小范围
+//
+// 每次按tab、每个单词着色都要调用 pl_readline_get_words 重新取一遍候选词，
+// 而大多数时候用户只是在同一个前缀后面多打了一个字符。
+// 打开缩小之后，回调给出的候选词连同前缀一起留下来，新的前缀是它的延伸时，
+// 直接在留下的候选词里把不匹配的去掉，不再调用回调。
+// 前缀变短（退格退到了缓存的前缀之前）或者换了一个单词时重新调用回调；
+// 回调的数据变了要调用 pl_readline_words_changed 让缓存作废。
+//
+// 只有回调对更长的前缀给出的候选词总是对短前缀给出的那些的子集时，这样做才是对的，
+// 所以默认不打开。模糊补全按子序列匹配，按前缀缩小会丢掉它要的词，所以不经过缓存。
+
+#include "pl_readline.h"
+#include <string.h>
+
+// 只留下以prefix开头的候选词
+static void narrow(pl_readline_words_t words, const char *prefix, usize len) {
+    isize kept = 0;
+    for (isize i = 0; i < words->len; i++) {
+        if (strncmp(words->words[i].word, prefix, len) == 0) words->words[kept++] = words->words[i];
+    }
+    words->len = kept;
+}
+
+// 不经过缓存：清空words并交给回调，返回words
+pl_readline_words_t pl_readline_fetch_words_uncached(_self, const char *prefix,
+                                                     pl_readline_words_t words) {
+    pl_readline_word_maker_clear(words);
+    if (self->pl_readline_get_words) {
+        self->pl_readline_get_words((char *)prefix, words);
+        PL_READLINE_COUNT(self, words_calls, 1);
+    }
+    return words;
+}
+
+// 回调对prefix给出的候选词。
+// 没有打开缩小时同 pl_readline_fetch_words_uncached；
+// 打开了缩小时返回实例上缓存的词组（只含以prefix开头的词），到下一次调用之前有效
+pl_readline_words_t pl_readline_fetch_words(_self, const char *prefix, pl_readline_words_t words) {
+    if (!self->narrow) return pl_readline_fetch_words_uncached(self, prefix, words);
+    usize len = strlen(prefix);
+    if (self->cand_prefix && self->cand_generation == self->words_generation &&
+        strncmp(prefix, self->cand_prefix, strlen(self->cand_prefix)) == 0) {
+        if (len > strlen(self->cand_prefix)) { // 前缀变长了，顺便把缓存缩小
+            char *copy = strdup(prefix);
+            if (copy) {
+                narrow(self->cand, prefix, len);
+                free(self->cand_prefix);
+                self->cand_prefix = copy;
+            }
+        }
+        PL_READLINE_COUNT(self, words_narrowed, 1);
+        return self->cand;
+    }
+    if (!self->cand && !(self->cand = pl_readline_word_maker_init())) {
+        self->narrow = false; // 内存不足，退回到每次调用回调
+        return pl_readline_fetch_words(self, prefix, words);
+    }
+    free(self->cand_prefix);
+    self->cand_prefix = NULL;
+    pl_readline_word_maker_clear(self->cand);
+    if (self->pl_readline_get_words) {
+        self->pl_readline_get_words((char *)prefix, self->cand);
+        PL_READLINE_COUNT(self, words_calls, 1);
+    }
+    narrow(self->cand, prefix, len); // 不以prefix开头的词对更长的前缀也没有用
+    self->cand_prefix     = strdup(prefix);
+    self->cand_generation = self->words_generation;
+    return self->cand;
+}
+
+// 打开或关闭缩小；回调对更长的前缀给出的候选词必须是短前缀的那些的子集
+void pl_readline_narrow_words(_self, bool enable) {
+    self->narrow = enable;
+    if (!enable) pl_readline_candidates_free(self);
+}
+
+// 回调的数据变了：缓存的候选词和颜色都作废
+void pl_readline_words_changed(_self) {
+    self->words_generation++;
+    pl_readline_invalidate_colors(self);
+}
+
+// 缓存太大时整个丢掉，下次用到时重新调用回调
+void pl_readline_candidates_trim(_self) {
+    if (pl_readline_candidates_memory(self) <= PL_READLINE_IDLE_KEEP) return;
+    free(self->cand_prefix);
+    self->cand_prefix = NULL;
+    if (self->cand) pl_readline_word_maker_trim(self->cand, PL_READLINE_IDLE_KEEP);
+}
+
+void pl_readline_candidates_free(_self) {
+    free(self->cand_prefix);
+    self->cand_prefix = NULL;
+    if (self->cand) pl_readline_word_maker_destroy(self->cand);
+    self->cand = NULL;
+}
+
+usize pl_readline_candidates_memory(_self) {
+    if (!self->cand) return 0;
+    usize size = pl_readline_word_maker_memory(self->cand);
+    if (self->cand_prefix) size += strlen(self->cand_prefix) + 1;
+    return size;
+}
@@ -17,13 +17,17 @@
 
 // Helper function to find the color of a command
 int get_command_color(_self, const char *word, int is_first_word) {
+    // 先查常驻词库
+    pl_readline_word info;
+    if (pl_readline_dict_lookup(pl_readline_dict_current(self), word, strlen(word), &info) &&
+        (is_first_word || !info.first)) {
+        return info.color;
+    }
+    if (!self->pl_readline_get_words) return PL_COLOR_RESET;
 
-    // printf("get_command_color: word='%s', is_first_word=%d\n", word, is_first_word);
-    // Initialize a temporary word list to hold commands
-    pl_readline_words_t word_list = pl_readline_word_maker_init();
-
-    // Get all defined commands
-    self->pl_readline_get_words((char *)word, word_list);
+    // Get all defined commands, reusing the instance's temporary word list
+    if (!pl_readline_word_maker_get(&self->words_temp)) return PL_COLOR_RESET;
+    pl_readline_words_t word_list = pl_readline_fetch_words(self, word, self->words_temp);
 
     // Check if the word exactly matches any of our defined commands
     for (isize i = 0; i < word_list->len; i++) {
@@ -32,179 +36,239 @@ int get_command_color(_self, const char *word, int is_first_word) {
 
         // Check exact match
         if (strcmp(word_list->words[i].word, word) == 0) {
-            int color = word_list->words[i].color;
-            pl_readline_word_maker_destroy(word_list);
-            return color;
+            return word_list->words[i].color;
         }
     }
 
-    // Clean up
-    pl_readline_word_maker_destroy(word_list);
     return PL_COLOR_RESET; // Default color
 }
 
-// Function to redisplay the buffer with colorized commands
-void redisplay_buffer_with_colors(_self, int show_prompt) {
-#define EXPAND_BUFFER                                                                                                    \
-    do {                                                                                                                 \
-        if (word_count == self->color_max_words) {                                                                             \
-            self->color_max_words *= 2;                                                                                  \
-            self->color_words = realloc(self->color_words, self->color_max_words * sizeof(char *));                      \
-        }                                                                                                                \
-    } while(0)
-    // Save original cursor position
-    size_t original_ptr = self->ptr;
-    size_t prompt_len   = 0;
-
-    // Calculate prompt length (only if shown)
-    if (self->prompt) {
-        // Count visible characters in the prompt (ignoring ANSI escape sequences)
-        char *p = self->prompt;
-        while (*p) {
-            if (*p == '\033') {
-                // Skip ANSI escape sequence
-                while (*p && *p != 'm')
-                    p++;
-                if (*p) p++; // Skip the 'm'
-                continue;
-            }
-            prompt_len++;
-            p++;
-        }
+// FNV-1a，first标志也算进哈希里
+static uint32_t color_hash(const char *word, bool is_first) {
+    uint32_t hash = 2166136261u ^ is_first;
+    while (*word) {
+        hash ^= (uint8_t)*word++;
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    // Move cursor back to start of line using absolute positioning
-    pl_readline_print(self, "\r");
-
-    // Display prompt only if requested
-    if (show_prompt) {
-        pl_readline_print(self, self->prompt);
-    } else if (prompt_len > 0) {
-        // If not showing prompt but there is a prompt, move cursor forward to skip prompt area
-        char forward_buf[32];
-        sprintf(forward_buf, "\033[%zuC", prompt_len);
-        pl_readline_print(self, forward_buf);
+// 带缓存的着色查询，命中时不再调用补全回调
+int pl_readline_word_color(_self, const char *word, bool is_first) {
+    if (!self->color_cache) {
+        self->color_cache = calloc(PL_READLINE_COLOR_CACHE_SIZE, sizeof(pl_readline_color_entry));
+        if (!self->color_cache) return get_command_color(self, word, is_first);
     }
+    uint32_t                 hash  = color_hash(word, is_first);
+    pl_readline_color_entry *entry = &self->color_cache[hash & (PL_READLINE_COLOR_CACHE_SIZE - 1)];
+    if (entry->word && entry->check == hash >> 16 && entry->first == is_first &&
+        entry->generation == self->color_generation && strcmp(entry->word, word) == 0) {
+        PL_READLINE_COUNT(self, color_cache_hits, 1);
+        return entry->color;
+    }
+    PL_READLINE_COUNT(self, color_cache_misses, 1);
+    int color = get_command_color(self, word, is_first);
+    free(entry->word); // 直接替换掉这个槽位上原来的单词
+    entry->word       = strdup(word);
+    entry->check      = hash >> 16;
+    entry->first      = is_first;
+    entry->color      = color;
+    entry->generation = self->color_generation;
+    return color;
+}
 
-    // Track position considering the prompt if shown
-    size_t display_position = prompt_len; // Start after prompt
-
-    // Clear the line after cursor
-    pl_readline_print(self, "\033[K");
+// 词库变了，之前缓存的颜色全部作废，下次重绘时整行重新着色
+void pl_readline_invalidate_colors(_self) {
+    self->color_generation++;
+    for (isize i = 0; i < self->token_count; i++) {
+        self->tokens[i].kind &= ~PL_READLINE_TOKEN_COLORED;
+    }
+    pl_readline_spans_reset(self);
+    self->dirty_from = 0;
+}
 
-    // Parse and colorize each word in the buffer
-    char  *buffer_copy = strdup(self->buffer);
-    size_t buffer_len  = strlen(buffer_copy);
+// 着色缓存占用的内存（字节）
+usize pl_readline_color_cache_memory(_self) {
+    if (!self->color_cache) return 0;
+    usize size = PL_READLINE_COLOR_CACHE_SIZE * sizeof(pl_readline_color_entry);
+    for (isize i = 0; i < PL_READLINE_COLOR_CACHE_SIZE; i++) {
+        if (self->color_cache[i].word) size += strlen(self->color_cache[i].word) + 1;
+    }
+    return size;
+}
 
-    // Handle empty buffer
-    if (buffer_len == 0) {
-        free(buffer_copy);
+// 一行结束后只在单词占的内存太多时释放单词，表留着，常用命令的颜色可以跨行使用
+void pl_readline_color_cache_trim(_self) {
+    if (!self->color_cache) return;
+    usize size = pl_readline_color_cache_memory(self);
+    if (size - PL_READLINE_COLOR_CACHE_SIZE * sizeof(pl_readline_color_entry) <=
+        PL_READLINE_IDLE_KEEP)
         return;
+    for (isize i = 0; i < PL_READLINE_COLOR_CACHE_SIZE; i++) {
+        free(self->color_cache[i].word);
+        self->color_cache[i].word = NULL;
     }
+}
 
-    // Get all tokens and preserve spaces
+void pl_readline_color_cache_free(_self) {
+    if (!self->color_cache) return;
+    for (isize i = 0; i < PL_READLINE_COLOR_CACHE_SIZE; i++) {
+        free(self->color_cache[i].word);
+    }
+    free(self->color_cache);
+    self->color_cache = NULL;
+}
 
-    if(!self->color_words) {
-        self->color_words = malloc(self->color_max_words * sizeof(char *));
+// 确保帧缓冲区能容纳len个单元；上一帧和新的一帧放在同一块内存里，新的一帧不用保留
+static bool frame_reserve(_self, isize len) {
+    if (len <= self->frame_cap) return true;
+    isize cap = self->frame_cap ? self->frame_cap : PL_READLINE_DEFAULT_BUFFER_LEN;
+    while (cap < len) {
+        cap *= 2;
     }
-    int   word_count = 0;
-    char *p          = buffer_copy;
-    char *word_start = p;
+    pl_readline_cell *frame = realloc(self->frame, cap * 2 * sizeof(pl_readline_cell));
+    if (!frame) return false;
+    self->frame     = frame;
+    self->frame_cap = cap;
+    return true;
+}
 
-    // Parse words and spaces
-    while (*p) {
-        if (*p == ' ') {
-            // Found a space - terminate the current word
-            *p = '\0';
-            EXPAND_BUFFER;
-            self->color_words[word_count++] = word_start;
-            if (word_start != buffer_copy ||
-                *buffer_copy != '\0') { // if the word is not empty
-                EXPAND_BUFFER;
-                self->color_words[word_count++] = p; // build a space word
-            }
-            // let the point p start from the next character which is not a
-            // space
-            p++; // we've set *p to '\0' so we need to move to the next character
-            while (*p == ' ' && *p != '\0') {
-              p++;
-            }
-            if(*p == '\0') {
-                // If we reached the end, break
-                word_start = p;
-                break;
-            }
-            word_start = p;
+// 终端上这一行已经是空的（刚输出了提示符），忘掉上一帧
+void pl_readline_frame_reset(_self) {
+    self->frame_len  = 0;
+    self->term_pos   = 0;
+    self->dirty_from = 0;
+}
 
-        }
-        p++;
-    }
-
-    // Don't forget the last word if it's not empty
-    if (*word_start && word_start[0] != '\0') { EXPAND_BUFFER; self->color_words[word_count++] = word_start; }
-    for (int i = 0; i < word_count; i++) {
-      if (self->color_words[i][0] == '\0') {
-            // This is a space (or spaces)
-            int p;
-            // calculate the length of the space
-            if (i < word_count - 1) { // there is a next word
-                p = self->color_words[i + 1] - self->color_words[i];
-            } else { // or it's the last word in the buffer
-                // calculate the length with the end position of the buffer
-                p = (buffer_copy + buffer_len) - self->color_words[i];
-            }
-            for(int j = 0; j < p; j++) {
-                pl_readline_print(self, " ");
-                display_position++;
-            }
-        } else {
-            // This is a word
-            // Check if this is the first word in the line
-#if PL_ENABLE_COLOR_FIRST_WORD_ONLY
-            int is_first = (i == 0);
-#else
-            int is_first =
-            (i == 0 || (i > 0 && self->color_words[i - 1][0] == '\0' && i == 1));
-#endif
-            int color = get_command_color(self, self->color_words[i], is_first);
-            if (color != PL_COLOR_RESET) {
-                // Apply color
-                char color_str[16];
-                sprintf(color_str, "\033[%dm", color);
-                pl_readline_print(self, color_str);
-            }
+// 把终端光标从当前位置移动到第pos个单元
+void pl_readline_move_cursor(_self, isize pos) {
+    char buf[32];
+    if (pos < self->term_pos) {
+        sprintf(buf, "\033[%dD", (int)(self->term_pos - pos));
+        pl_readline_print(self, buf);
+    } else if (pos > self->term_pos) {
+        sprintf(buf, "\033[%dC", (int)(pos - self->term_pos));
+        pl_readline_print(self, buf);
+    }
+    self->term_pos = pos;
+}
 
-            // Print the word
-            pl_readline_print(self, self->color_words[i]);
-            display_position += strlen(self->color_words[i]);
+// 输出第from到to个单元，颜色只在变化时切换
+static void emit_cells(_self, pl_readline_cell *cells, isize from, isize to) {
+    char color_str[16];
+    int  current = PL_COLOR_RESET;
+    pl_readline_move_cursor(self, from);
+    for (isize i = from; i < to; i++) {
+        if (cells[i].color != current) {
+            current = cells[i].color;
+            sprintf(color_str, "\033[%dm", current);
+            pl_readline_print(self, color_str);
+        }
+        pl_readline_putch(self, cells[i].ch);
+    }
+    if (current != PL_COLOR_RESET) pl_readline_print(self, "\033[0m");
+    self->term_pos = to;
+}
 
-            if (color != PL_COLOR_RESET) {
-                // Reset color
-                pl_readline_print(self, "\033[0m");
+// 生成当前缓冲区从from开始的部分对应的一帧（字符+颜色）
+// from之前的单词既没有被改动也没有重新着色，沿用上一帧
+static void build_frame(_self, pl_readline_cell *cells, isize from) {
+    char  small[64];
+    char *word     = small;
+    isize word_cap = sizeof(small);
+    for (isize i = from; i < self->length; i++) {
+        cells[i].ch    = pl_readline_buffer_at(self, i);
+        cells[i].color = PL_COLOR_RESET;
+    }
+    if (self->pl_readline_highlight) { // 由应用程序给出着色区间
+        pl_readline_spans_paint(self, cells, from);
+        return;
+    }
+    isize n = pl_readline_token_at(self, from);
+    for (n = n < 0 ? 0 : n; n < self->token_count; n++) {
+        pl_readline_token *token = &self->tokens[n];
+        if (token->start + token->len <= from) continue;
+        if (!(token->kind & PL_READLINE_TOKEN_COLORED)) {
+            if (token->len + 1 > word_cap) { // 单词太长，换成堆上的缓冲区
+                while (token->len + 1 > word_cap) {
+                    word_cap *= 2;
+                }
+                char *p = realloc(word == small ? NULL : word, word_cap);
+                if (!p) break;
+                word = p;
             }
+            pl_readline_buffer_copy(self, token->start, token->start + token->len, word);
+            word[token->len] = '\0';
+            token->color =
+                pl_readline_word_color(self, word, pl_readline_token_is_first(self, token->start));
+            token->kind |= PL_READLINE_TOKEN_COLORED;
+        }
+        for (isize j = token->start; j < token->start + token->len; j++) {
+            cells[j].color = token->color;
         }
     }
+    if (word != small) free(word);
+}
 
-    free(buffer_copy);
-
-    // If original buffer ends with space, print it
-    if (self->length > 0 && self->buffer[self->length - 1] == ' ') {
-        pl_readline_print(self, " ");
-        display_position++;
+// 设置画在输入行后面的提示，len为0时清除
+void pl_readline_set_annotation(_self, const char *text, isize len, int color) {
+    if (len > self->annotation_cap) {
+        char *p = realloc(self->annotation, len);
+        if (!p) return;
+        self->annotation     = p;
+        self->annotation_cap = len;
     }
+    if (len) memcpy(self->annotation, text, len);
+    self->annotation_len   = len;
+    self->annotation_color = color;
+}
 
-    // Calculate cursor position (prompt + original_ptr)
-    size_t target_position = prompt_len + original_ptr;
-
-    // Position cursor correctly
-    if (display_position != target_position) {
-        // Use absolute positioning from the left edge
+// 重绘输入行：记住上一次画出的帧，只输出发生变化的区间
+void redisplay_buffer_with_colors(_self, int show_prompt) {
+    if (show_prompt) {
         pl_readline_print(self, "\r");
+        pl_readline_print(self, self->prompt);
+        pl_readline_print(self, "\033[K");
+        pl_readline_frame_reset(self);
+    }
+#if PL_ENABLE_AUTOSUGGEST
+    pl_readline_suggest_refresh(self);
+#endif
+    if (!frame_reserve(self, self->length + self->annotation_len)) return;
+    pl_readline_spans_refresh(self);
+
+    isize old_len = self->frame_len;
+    isize new_len = self->length + self->annotation_len;
+    isize from    = self->dirty_from < self->length ? self->dirty_from : self->length;
+    if (from > old_len) from = old_len;
+    pl_readline_cell *old = self->frame;
+    pl_readline_cell *cur = self->frame + self->frame_cap;
+    build_frame(self, cur, from);
+    for (isize i = 0; i < self->annotation_len; i++) { // 提示每次都重新生成，反正很短
+        cur[self->length + i].ch    = self->annotation[i];
+        cur[self->length + i].color = self->annotation_color;
+    }
 
-        if (target_position > 0) {
-            char move_buf[32];
-            sprintf(move_buf, "\033[%zuC", target_position);
-            pl_readline_print(self, move_buf);
+    // 找到第一个不同的单元
+    isize first = from;
+    while (first < old_len && first < new_len && old[first].ch == cur[first].ch &&
+           old[first].color == cur[first].color) {
+        first++;
+    }
+    if (first < old_len || first < new_len) {
+        isize last = new_len;
+        if (old_len == new_len) { // 长度不变时，尾部相同的部分也不用重画
+            while (last > first && old[last - 1].ch == cur[last - 1].ch &&
+                   old[last - 1].color == cur[last - 1].color) {
+                last--;
+            }
         }
+        emit_cells(self, cur, first, last);
+        if (new_len < old_len) pl_readline_print(self, "\033[K"); // 新的一帧更短，清掉多余的部分
     }
+    pl_readline_move_cursor(self, self->ptr);
+
+    if (new_len > from) memcpy(old + from, cur + from, (new_len - from) * sizeof(pl_readline_cell));
+    self->frame_len  = new_len;
+    self->dirty_from = self->length;
 }
@@ -0,0 +1,427 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_dict.c : 常驻的补全词库（基数树）
+//
+// 通过 pl_readline_dict_add/remove 注册的词存放在这棵基数树里，
+// 按前缀查找只需要走一遍前缀再遍历匹配的子树，公共前缀也可以直接沿着树得到，
+// 不用每次按 tab 都让应用程序重新生成整个词库。
+
+#include "pl_readline.h"
+#include <string.h>
+
+typedef struct pl_readline_trie_node {
+    char                          *label;       // 从父节点到这里的边上的字符
+    isize                          label_len;   // 边的长度
+    struct pl_readline_trie_node **children;    // 子节点，按标签首字符排序
+    isize                          child_count; // 子节点数量
+    isize                          child_cap;   // 子节点数组容量
+    usize                          total;       // 子树中词的数量
+    usize                          anywhere;    // 子树中 first 为 false 的词的数量
+    bool                           terminal;    // 是否是一个完整的词
+    bool                           first;       // 同 pl_readline_word
+    char                           sep;
+    int                            color;
+} pl_readline_trie_node;
+
+struct pl_readline_dict {
+    pl_readline_trie_node root;
+};
+
+// 子树里在当前位置可以补全的词的数量
+static usize node_eligible(const pl_readline_trie_node *node, bool is_first) {
+    return is_first ? node->total : node->anywhere;
+}
+
+static pl_readline_trie_node *node_new(const char *label, isize len) {
+    pl_readline_trie_node *node = calloc(1, sizeof(pl_readline_trie_node));
+    if (!node) return NULL;
+    node->label = malloc(len + 1);
+    if (!node->label) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->label, label, len);
+    node->label[len] = '\0';
+    node->label_len  = len;
+    return node;
+}
+
+static void node_free(pl_readline_trie_node *node) {
+    for (isize i = 0; i < node->child_count; i++) {
+        node_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->label);
+    free(node);
+}
+
+// 二分查找首字符为ch的子节点，找不到时返回应插入的位置
+static isize child_index(const pl_readline_trie_node *node, char ch, bool *found) {
+    isize lo = 0, hi = node->child_count;
+    while (lo < hi) {
+        isize mid = (lo + hi) / 2;
+        char  c   = node->children[mid]->label[0];
+        if (c == ch) {
+            *found = true;
+            return mid;
+        }
+        if ((unsigned char)c < (unsigned char)ch) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = false;
+    return lo;
+}
+
+static bool child_insert(pl_readline_trie_node *node, isize idx, pl_readline_trie_node *child) {
+    if (node->child_count == node->child_cap) {
+        isize                   cap = node->child_cap ? node->child_cap * 2 : 2;
+        pl_readline_trie_node **p   = realloc(node->children, cap * sizeof(*p));
+        if (!p) return false;
+        node->children  = p;
+        node->child_cap = cap;
+    }
+    memmove(node->children + idx + 1, node->children + idx,
+            (node->child_count - idx) * sizeof(*node->children));
+    node->children[idx] = child;
+    node->child_count++;
+    return true;
+}
+
+pl_readline_dict_t pl_readline_dict_new(void) {
+    return calloc(1, sizeof(struct pl_readline_dict));
+}
+
+void pl_readline_dict_free(pl_readline_dict_t dict) {
+    if (!dict) return;
+    for (isize i = 0; i < dict->root.child_count; i++) {
+        node_free(dict->root.children[i]);
+    }
+    free(dict->root.children);
+    free(dict);
+}
+
+// 深拷贝node的子节点到copy，copy的其它字段已经复制好了
+static bool node_clone_children(pl_readline_trie_node *copy, const pl_readline_trie_node *node) {
+    copy->children    = NULL;
+    copy->child_count = copy->child_cap = 0;
+    if (!node->child_count) return true;
+    copy->children = malloc(node->child_count * sizeof(*copy->children));
+    if (!copy->children) return false;
+    copy->child_cap = node->child_count;
+    for (isize i = 0; i < node->child_count; i++) {
+        const pl_readline_trie_node *child = node->children[i];
+        pl_readline_trie_node       *c     = node_new(child->label, child->label_len);
+        if (!c) return false;
+        c->total    = child->total;
+        c->anywhere = child->anywhere;
+        c->terminal = child->terminal;
+        c->first    = child->first;
+        c->sep      = child->sep;
+        c->color    = child->color;
+        copy->children[copy->child_count++] = c;
+        if (!node_clone_children(c, child)) return false;
+    }
+    return true;
+}
+
+// 复制一份词库，用来在旧版本的基础上做出新版本
+pl_readline_dict_t pl_readline_dict_clone(pl_readline_dict_t dict) {
+    pl_readline_dict_t copy = pl_readline_dict_new();
+    if (!copy || !dict) return copy;
+    copy->root = dict->root;
+    if (!node_clone_children(&copy->root, &dict->root)) {
+        pl_readline_dict_free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+static usize node_memory(const pl_readline_trie_node *node) {
+    usize size = node->child_cap * sizeof(pl_readline_trie_node *);
+    for (isize i = 0; i < node->child_count; i++) {
+        const pl_readline_trie_node *child = node->children[i];
+        size += sizeof(pl_readline_trie_node) + child->label_len + 1 + node_memory(child);
+    }
+    return size;
+}
+
+// 占用的内存（字节）
+usize pl_readline_dict_memory(pl_readline_dict_t dict) {
+    return dict ? sizeof(struct pl_readline_dict) + node_memory(&dict->root) : 0;
+}
+
+// 把node的标签在第at个字符处断开，后半段成为唯一的子节点
+static bool node_split(pl_readline_trie_node *node, isize at) {
+    pl_readline_trie_node *tail = node_new(node->label + at, node->label_len - at);
+    if (!tail) return false;
+    tail->children    = node->children;
+    tail->child_count = node->child_count;
+    tail->child_cap   = node->child_cap;
+    tail->total       = node->total;
+    tail->anywhere    = node->anywhere;
+    tail->terminal    = node->terminal;
+    tail->first       = node->first;
+    tail->sep         = node->sep;
+    tail->color       = node->color;
+    node->children    = NULL;
+    node->child_count = node->child_cap = 0;
+    node->terminal    = false;
+    if (!child_insert(node, 0, tail)) {
+        node->children    = tail->children;
+        node->child_count = tail->child_count;
+        node->child_cap   = tail->child_cap;
+        node->terminal    = tail->terminal;
+        tail->children    = NULL;
+        tail->child_count = 0;
+        node_free(tail);
+        return false;
+    }
+    node->label_len = at;
+    node->label[at] = '\0';
+    return true;
+}
+
+bool pl_readline_dict_insert(pl_readline_dict_t dict, const char *word, bool first, int color,
+                             char sep) {
+    isize            len = strlen(word);
+    pl_readline_word old;
+    bool             exists = pl_readline_dict_lookup(dict, word, len, &old);
+
+    // 先找到（或建出）这个词对应的节点
+    pl_readline_trie_node *node = &dict->root;
+    for (isize i = 0; i < len;) {
+        bool  found;
+        isize idx = child_index(node, word[i], &found);
+        if (!found) {
+            pl_readline_trie_node *leaf = node_new(word + i, len - i);
+            if (!leaf || !child_insert(node, idx, leaf)) {
+                if (leaf) node_free(leaf);
+                return false;
+            }
+            node = leaf;
+            break;
+        }
+        pl_readline_trie_node *child = node->children[idx];
+        isize                  n     = 0;
+        while (n < child->label_len && i + n < len && child->label[n] == word[i + n]) {
+            n++;
+        }
+        if (n < child->label_len && !node_split(child, n)) return false;
+        node  = child;
+        i    += n;
+    }
+    node->terminal = true;
+    node->first    = first;
+    node->sep      = sep;
+    node->color    = color;
+
+    // 再沿路径更新计数
+    isize total    = !exists;
+    isize anywhere = !first - (exists && !old.first);
+    node           = &dict->root;
+    for (isize i = 0;; i += node->label_len) {
+        node->total    += total;
+        node->anywhere += anywhere;
+        if (i == len) break;
+        bool found;
+        node = node->children[child_index(node, word[i], &found)];
+    }
+    return true;
+}
+
+// 没有词也没有子节点的节点删掉，只剩一个子节点的非词节点和子节点合并
+static void node_compact(pl_readline_trie_node *parent, isize idx) {
+    pl_readline_trie_node *node = parent->children[idx];
+    if (node->terminal) return;
+    if (node->child_count == 0) {
+        memmove(parent->children + idx, parent->children + idx + 1,
+                (parent->child_count - idx - 1) * sizeof(*parent->children));
+        parent->child_count--;
+        node_free(node);
+    } else if (node->child_count == 1) {
+        pl_readline_trie_node *child = node->children[0];
+        char *label = malloc(node->label_len + child->label_len + 1);
+        if (!label) return; // 不合并也不影响正确性
+        memcpy(label, node->label, node->label_len);
+        memcpy(label + node->label_len, child->label, child->label_len + 1);
+        free(child->label);
+        child->label           = label;
+        child->label_len      += node->label_len;
+        parent->children[idx]  = child;
+        free(node->children);
+        free(node->label);
+        free(node);
+    }
+}
+
+static bool node_erase(pl_readline_trie_node *node, const char *word, isize len, bool *anywhere) {
+    if (!len) {
+        if (!node->terminal) return false;
+        *anywhere      = !node->first;
+        node->terminal = false;
+    } else {
+        bool  found;
+        isize idx = child_index(node, *word, &found);
+        if (!found) return false;
+        pl_readline_trie_node *child = node->children[idx];
+        if (child->label_len > len || memcmp(child->label, word, child->label_len)) return false;
+        if (!node_erase(child, word + child->label_len, len - child->label_len, anywhere))
+            return false;
+        node_compact(node, idx);
+    }
+    node->total--;
+    node->anywhere -= *anywhere;
+    return true;
+}
+
+bool pl_readline_dict_erase(pl_readline_dict_t dict, const char *word) {
+    bool anywhere;
+    return node_erase(&dict->root, word, strlen(word), &anywhere);
+}
+
+// 沿着前缀往下走，返回所有匹配的词所在子树的根
+// rest 为该节点标签中前缀之后剩下的部分
+static const pl_readline_trie_node *dict_walk(pl_readline_dict_t dict, const char *prefix,
+                                              isize len, const char **rest) {
+    const pl_readline_trie_node *node = &dict->root;
+    isize                        i    = 0;
+    *rest                             = "";
+    while (i < len) {
+        bool  found;
+        isize idx = child_index(node, prefix[i], &found);
+        if (!found) return NULL;
+        const pl_readline_trie_node *child = node->children[idx];
+        isize                        n = child->label_len < len - i ? child->label_len : len - i;
+        if (memcmp(child->label, prefix + i, n)) return NULL;
+        node  = child;
+        i    += n;
+        *rest = child->label + n;
+    }
+    return node;
+}
+
+bool pl_readline_dict_lookup(pl_readline_dict_t dict, const char *word, isize len,
+                             pl_readline_word *out) {
+    const char                  *rest;
+    const pl_readline_trie_node *node = dict ? dict_walk(dict, word, len, &rest) : NULL;
+    if (!node || *rest || !node->terminal) return false;
+    out->word  = NULL;
+    out->first = node->first;
+    out->sep   = node->sep;
+    out->color = node->color;
+    return true;
+}
+
+usize pl_readline_dict_count(pl_readline_dict_t dict, const char *prefix, isize len, bool is_first) {
+    const char                  *rest;
+    const pl_readline_trie_node *node = dict ? dict_walk(dict, prefix, len, &rest) : NULL;
+    return node ? node_eligible(node, is_first) : 0;
+}
+
+// 简单的可增长字符串，用于拼出完整的词
+typedef struct {
+    char *data;
+    usize len;
+    usize cap;
+} strbuf;
+
+static bool strbuf_append(strbuf *sb, const char *str, usize len) {
+    if (sb->len + len + 1 > sb->cap) {
+        usize cap = sb->cap ? sb->cap : 32;
+        while (sb->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *p = realloc(sb->data, cap);
+        if (!p) return false;
+        sb->data = p;
+        sb->cap  = cap;
+    }
+    memcpy(sb->data + sb->len, str, len);
+    sb->len           += len;
+    sb->data[sb->len]  = '\0';
+    return true;
+}
+
+char *pl_readline_dict_common_prefix(pl_readline_dict_t dict, const char *prefix, isize len,
+                                     bool is_first) {
+    const char                  *rest;
+    const pl_readline_trie_node *node = dict && len >= 0 ? dict_walk(dict, prefix, len, &rest) : NULL;
+    if (!node) return NULL;
+    usize count = node_eligible(node, is_first);
+    // 和前缀完全一样的词不算
+    if (!*rest && node->terminal && (is_first || !node->first)) count--;
+    if (!count) return NULL;
+
+    strbuf sb = {0};
+    if (!strbuf_append(&sb, prefix, len) || !strbuf_append(&sb, rest, strlen(rest))) {
+        free(sb.data);
+        return NULL;
+    }
+    while (!(node->terminal && (is_first || !node->first) && sb.len > (usize)len)) {
+        const pl_readline_trie_node *next = NULL;
+        for (isize i = 0; i < node->child_count; i++) {
+            if (!node_eligible(node->children[i], is_first)) continue;
+            if (next) { // 分叉了，公共前缀到此为止
+                next = NULL;
+                break;
+            }
+            next = node->children[i];
+        }
+        if (!next || !strbuf_append(&sb, next->label, next->label_len)) break;
+        node = next;
+    }
+    return sb.data;
+}
+
+static void dict_collect(const pl_readline_trie_node *node, strbuf *sb, bool is_first,
+                         pl_readline_words_t out) {
+    if (node->terminal && (is_first || !node->first)) {
+        pl_readline_word_maker_add(sb->data, out, node->first, node->color, node->sep);
+    }
+    for (isize i = 0; i < node->child_count; i++) {
+        const pl_readline_trie_node *child = node->children[i];
+        if (!node_eligible(child, is_first)) continue;
+        usize len = sb->len;
+        if (!strbuf_append(sb, child->label, child->label_len)) return;
+        dict_collect(child, sb, is_first, out);
+        sb->len           = len;
+        sb->data[sb->len] = '\0';
+    }
+}
+
+void pl_readline_dict_collect(pl_readline_dict_t dict, const char *prefix, isize len, bool is_first,
+                              pl_readline_words_t out) {
+    const char                  *rest;
+    const pl_readline_trie_node *node = dict && len >= 0 ? dict_walk(dict, prefix, len, &rest) : NULL;
+    if (!node || !node_eligible(node, is_first)) return;
+    strbuf sb = {0};
+    if (strbuf_append(&sb, prefix, len) && strbuf_append(&sb, rest, strlen(rest))) {
+        dict_collect(node, &sb, is_first, out);
+    }
+    free(sb.data);
+}
+
+int pl_readline_dict_add(_self, const char *word, bool first, int color, char sep) {
+    if (!*word) return PL_READLINE_FAILED;
+    if (!self->dict && !(self->dict = pl_readline_dict_new())) return PL_READLINE_FAILED;
+    if (!pl_readline_dict_insert(self->dict, word, first, color, sep)) return PL_READLINE_FAILED;
+    pl_readline_invalidate_colors(self);
+    return PL_READLINE_SUCCESS;
+}
+
+int pl_readline_dict_remove(_self, const char *word) {
+    if (!self->dict || !pl_readline_dict_erase(self->dict, word)) return PL_READLINE_FAILED;
+    pl_readline_invalidate_colors(self);
+    return PL_READLINE_SUCCESS;
+}
@@ -0,0 +1,198 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_dictshare.c : 多个实例（可以在不同线程）共用的只读词库
+//
+// 共用的词库由一个个版本组成，每个版本发布之后就不再修改。修改时复制出新版本，改好后原子地替换掉当前版本。
+// 实例在每次按键前看一眼当前版本，变了才换过去，并持有它的引用，
+// 旧版本在最后一个持有它的实例换走之后释放，读的一方从不加锁。
+//
+// 取得当前版本和给它加引用之间有一个空档，发布者可能正好在这时丢掉了旧版本。
+// 所以读的一方在这个空档里要登记在两个计数器中的一个上（按当前的纪元），
+// 发布者换掉版本后切换纪元，等旧纪元的计数归零，才放掉对旧版本的引用。
+//
+// 模糊补全的索引也挂在版本上：第一个用到的实例建立它，其它实例直接用，随版本一起释放。
+
+#include "pl_readline.h"
+
+#if PL_ENABLE_SHARED_DICT
+#    include <stdatomic.h>
+
+struct pl_readline_dict_version {
+    pl_readline_dict_t           dict;  // 发布之后不再修改
+    atomic_size_t                refs;  // 当前版本本身算一个，每个持有它的实例各算一个
+    _Atomic(pl_readline_fuzzy_t) fuzzy; // 模糊补全的索引，第一次用到时建立
+};
+
+struct pl_readline_shared_dict {
+    _Atomic(pl_readline_dict_version_t) current;
+    atomic_uint                         epoch;      // 读的一方登记在 readers[epoch] 上
+    atomic_size_t                       readers[2]; // 正在取得版本的读者数
+    atomic_flag                         writer;     // 发布者之间互斥
+    atomic_size_t                       refs;       // 创建者和每个挂上的实例各算一个
+};
+
+static pl_readline_dict_version_t version_new(pl_readline_dict_t dict) {
+    pl_readline_dict_version_t version = malloc(sizeof(struct pl_readline_dict_version));
+    if (!version) return NULL;
+    version->dict = dict;
+    atomic_init(&version->refs, 1);
+    atomic_init(&version->fuzzy, NULL);
+    return version;
+}
+
+static void version_release(pl_readline_dict_version_t version) {
+    if (atomic_fetch_sub(&version->refs, 1) != 1) return;
+    pl_readline_fuzzy_index_free(atomic_load(&version->fuzzy));
+    pl_readline_dict_free(version->dict);
+    free(version);
+}
+
+// 版本的模糊补全索引，调用者持有版本的引用。
+// 几个实例同时第一次用到时各自建立，只留下先放上去的那个；内存不足时返回NULL
+pl_readline_fuzzy_t pl_readline_dict_version_fuzzy(pl_readline_dict_version_t version) {
+    pl_readline_fuzzy_t fuzzy = atomic_load(&version->fuzzy);
+    if (fuzzy) return fuzzy;
+    pl_readline_fuzzy_t built = pl_readline_fuzzy_index_new(version->dict);
+    if (!built) return NULL;
+    if (atomic_compare_exchange_strong(&version->fuzzy, &fuzzy, built)) return built;
+    pl_readline_fuzzy_index_free(built); // 别人先建好了
+    return fuzzy;
+}
+
+// 取得当前版本并加上引用
+static pl_readline_dict_version_t version_acquire(pl_readline_shared_dict_t shared) {
+    unsigned epoch;
+    for (;;) {
+        epoch = atomic_load(&shared->epoch);
+        atomic_fetch_add(&shared->readers[epoch], 1);
+        if (atomic_load(&shared->epoch) == epoch) break;
+        atomic_fetch_sub(&shared->readers[epoch], 1); // 纪元刚切换过，发布者可能已经不等这个计数了
+    }
+    pl_readline_dict_version_t version = atomic_load(&shared->current);
+    atomic_fetch_add(&version->refs, 1);
+    atomic_fetch_sub(&shared->readers[epoch], 1);
+    return version;
+}
+
+pl_readline_shared_dict_t pl_readline_shared_dict_new(void) {
+    pl_readline_shared_dict_t shared = malloc(sizeof(struct pl_readline_shared_dict));
+    if (!shared) return NULL;
+    pl_readline_dict_t         dict    = pl_readline_dict_new();
+    pl_readline_dict_version_t version = dict ? version_new(dict) : NULL;
+    if (!version) {
+        pl_readline_dict_free(dict);
+        free(shared);
+        return NULL;
+    }
+    atomic_init(&shared->current, version);
+    atomic_init(&shared->epoch, 0);
+    atomic_init(&shared->readers[0], 0);
+    atomic_init(&shared->readers[1], 0);
+    atomic_flag_clear(&shared->writer);
+    atomic_init(&shared->refs, 1);
+    return shared;
+}
+
+// 放掉创建者的引用，最后一个实例摘下之后整个释放
+void pl_readline_shared_dict_release(pl_readline_shared_dict_t shared) {
+    if (!shared || atomic_fetch_sub(&shared->refs, 1) != 1) return;
+    version_release(atomic_load(&shared->current));
+    free(shared);
+}
+
+// 换上新版本，调用者持有发布者的锁
+static void publish_locked(pl_readline_shared_dict_t shared, pl_readline_dict_version_t version) {
+    pl_readline_dict_version_t old   = atomic_exchange(&shared->current, version);
+    unsigned                   epoch = atomic_load(&shared->epoch);
+    atomic_store(&shared->epoch, !epoch);
+    while (atomic_load(&shared->readers[epoch])) {} // 读者只在两次原子操作之间登记，很快就会走
+    version_release(old);
+}
+
+static void writer_lock(pl_readline_shared_dict_t shared) {
+    while (atomic_flag_test_and_set(&shared->writer)) {}
+}
+
+// 用dict（调用者不再修改它）替换掉当前版本
+int pl_readline_shared_dict_publish(pl_readline_shared_dict_t shared, pl_readline_dict_t dict) {
+    pl_readline_dict_version_t version = version_new(dict);
+    if (!version) return PL_READLINE_FAILED;
+    writer_lock(shared);
+    publish_locked(shared, version);
+    atomic_flag_clear(&shared->writer);
+    return PL_READLINE_SUCCESS;
+}
+
+// 复制一份当前版本，改完之后交给 pl_readline_shared_dict_publish
+pl_readline_dict_t pl_readline_shared_dict_copy(pl_readline_shared_dict_t shared) {
+    pl_readline_dict_version_t version = version_acquire(shared);
+    pl_readline_dict_t         dict    = pl_readline_dict_clone(version->dict);
+    version_release(version);
+    return dict;
+}
+
+// 在当前版本的副本上加入或删除一个词并发布，整个过程持有发布者的锁，不会丢掉别人的修改
+static int modify(pl_readline_shared_dict_t shared, const char *word, bool add, bool first,
+                  int color, char sep) {
+    writer_lock(shared);
+    pl_readline_dict_version_t current = atomic_load(&shared->current); // 持有锁时不会被释放
+    pl_readline_dict_t         dict    = pl_readline_dict_clone(current->dict);
+    pl_readline_dict_version_t version = NULL;
+    bool ok = dict && (add ? pl_readline_dict_insert(dict, word, first, color, sep)
+                           : pl_readline_dict_erase(dict, word));
+    if (ok && (version = version_new(dict))) publish_locked(shared, version);
+    atomic_flag_clear(&shared->writer);
+    if (version) return PL_READLINE_SUCCESS;
+    pl_readline_dict_free(dict);
+    return PL_READLINE_FAILED;
+}
+
+// 每次修改都要复制整个词库，一次加很多词时请用 copy/publish
+int pl_readline_shared_dict_add(pl_readline_shared_dict_t shared, const char *word, bool first,
+                                int color, char sep) {
+    if (!*word) return PL_READLINE_FAILED;
+    return modify(shared, word, true, first, color, sep);
+}
+
+int pl_readline_shared_dict_remove(pl_readline_shared_dict_t shared, const char *word) {
+    return modify(shared, word, false, false, 0, 0);
+}
+
+// 把实例挂到共用的词库上（NULL为摘下），挂上之后不再使用实例自己的词库
+int pl_readline_attach_dict(_self, pl_readline_shared_dict_t shared) {
+    if (shared) atomic_fetch_add(&shared->refs, 1);
+    if (self->dict_version) version_release(self->dict_version);
+    pl_readline_shared_dict_release(self->shared_dict);
+    self->shared_dict  = shared;
+    self->dict_version = shared ? version_acquire(shared) : NULL;
+    if (shared) pl_readline_fuzzy_free(self); // 挂上之后用版本上的索引
+    pl_readline_invalidate_colors(self);
+    return PL_READLINE_SUCCESS;
+}
+
+// 发布了新版本就换过去，每次按键前调用，没有变化时只是一次原子读
+void pl_readline_dict_sync(_self) {
+    pl_readline_shared_dict_t shared = self->shared_dict;
+    if (!shared || atomic_load(&shared->current) == self->dict_version) return;
+    pl_readline_dict_version_t version = version_acquire(shared);
+    version_release(self->dict_version);
+    self->dict_version = version;
+    pl_readline_invalidate_colors(self);
+}
+#endif
+
+// 补全和着色用的词库：挂上了共用的词库时是它的当前版本，否则是实例自己的
+pl_readline_dict_t pl_readline_dict_current(_self) {
+#if PL_ENABLE_SHARED_DICT
+    if (self->dict_version) return self->dict_version->dict;
+#endif
+    return self->dict;
+}
@@ -0,0 +1,387 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_fuzzy.c : 模糊补全
+//
+// 输入的单词作为子序列去匹配候选词（gco 可以找到 git-checkout），按 fzf 的方式打分：
+// 匹配的字符在单词开头、分隔符或大小写交界之后，或者连在一起时得分高，中间跳过的字符扣分。
+// 查询里有大写字母时区分大小写，否则不区分。
+//
+// 词库很大（几十万个词）时也要跟得上按键，所以：
+//   - 词库展开成一个平铺的索引，每个词带一个64位的字符集合，词库变了（color_generation变了）才重建；
+//     挂上共用的词库时索引跟着版本走，同一个版本只建一次，所有实例共用；
+//   - 先用字符集合筛掉不可能匹配的词，SSE2一次比较2个、AVX2一次比较4个；
+//   - 剩下的词在按顺序找每个查询字符时，一次比较16/32个字节；
+//   - 只保留得分最高的k个（小根堆），不对所有匹配的词排序。
+// 没有打开 PL_ENABLE_SIMD 或者编译器没有打开对应的指令集时用普通的循环。
+
+#include "pl_readline.h"
+#include <string.h>
+
+#if PL_ENABLE_SIMD && defined(__GNUC__) && defined(__AVX2__)
+#    include <immintrin.h>
+#    define FUZZY_AVX2 1
+#endif
+#if PL_ENABLE_SIMD && defined(__GNUC__) && defined(__SSE2__)
+#    include <emmintrin.h>
+#    define FUZZY_SSE2 1
+#endif
+
+#define SCORE_MATCH       16 // 每个匹配的字符
+#define SCORE_GAP_START   -3 // 跳过的第一个字符
+#define SCORE_GAP_EXT     -1 // 继续跳过的字符
+#define BONUS_BOUNDARY    8  // 在单词开头或分隔符之后
+#define BONUS_CAMEL       7  // 小写之后的大写、字母之后的数字
+#define BONUS_CONSECUTIVE 4  // 和上一个匹配的字符连在一起
+#define BONUS_FIRST_MUL   2  // 查询的第一个字符的加成翻倍
+
+struct pl_readline_fuzzy {
+    pl_readline_words_t words;      // 词库里所有的词
+    uint64_t           *masks;      // 每个词含有的字符
+    uint32_t           *lens;       // 每个词的长度
+    usize               cap;        // masks、lens 的容量
+    uint32_t            generation; // 建立时的 color_generation
+    bool                built;
+};
+
+// 查询以及它的字符集合
+typedef struct fuzzy_query {
+    const char *str;
+    usize       len;
+    uint64_t    mask;
+    bool        case_sensitive;
+} fuzzy_query;
+
+typedef struct fuzzy_hit {
+    int                     score;
+    uint32_t                len;
+    usize                   order; // 词库里的词在前，回调给出的在后
+    const pl_readline_word *word;
+} fuzzy_hit;
+
+// 得分最高的k个匹配，堆顶是其中最差的
+typedef struct fuzzy_heap {
+    fuzzy_hit *hits;
+    usize      count;
+    usize      k;
+} fuzzy_heap;
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// 字母不分大小写占26位，数字占10位，其它字节共用剩下的28位
+static uint64_t char_bit(unsigned char c) {
+    c = fold(c);
+    if (c >= 'a' && c <= 'z') return (uint64_t)1 << (c - 'a');
+    if (c >= '0' && c <= '9') return (uint64_t)1 << (26 + c - '0');
+    return (uint64_t)1 << (36 + c % 28);
+}
+
+static uint64_t string_mask(const char *s, usize len) {
+    uint64_t mask = 0;
+    for (usize i = 0; i < len; i++) {
+        mask |= char_bit(s[i]);
+    }
+    return mask;
+}
+
+static void query_init(fuzzy_query *q, const char *str) {
+    q->str            = str;
+    q->len            = strlen(str);
+    q->mask           = string_mask(str, q->len);
+    q->case_sensitive = false;
+    for (usize i = 0; i < q->len; i++) {
+        if (str[i] >= 'A' && str[i] <= 'Z') q->case_sensitive = true;
+    }
+}
+
+// 从pos开始找第一个等于a或b的字节（a、b是同一个字符的两种大小写），找不到时返回-1
+static isize find_char(const char *s, isize len, isize pos, unsigned char a, unsigned char b) {
+#ifdef FUZZY_AVX2
+    __m256i va = _mm256_set1_epi8((char)a);
+    __m256i vb = _mm256_set1_epi8((char)b);
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i  v    = _mm256_loadu_si256((const __m256i *)(s + pos));
+        __m256i  eq   = _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb));
+        unsigned bits = (unsigned)_mm256_movemask_epi8(eq);
+        if (bits) return pos + __builtin_ctz(bits);
+    }
+#endif
+#ifdef FUZZY_SSE2
+    __m128i xa = _mm_set1_epi8((char)a);
+    __m128i xb = _mm_set1_epi8((char)b);
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i  v    = _mm_loadu_si128((const __m128i *)(s + pos));
+        __m128i  eq   = _mm_or_si128(_mm_cmpeq_epi8(v, xa), _mm_cmpeq_epi8(v, xb));
+        unsigned bits = (unsigned)_mm_movemask_epi8(eq);
+        if (bits) return pos + __builtin_ctz(bits);
+    }
+#endif
+    for (; pos < len; pos++) {
+        if ((unsigned char)s[pos] == a || (unsigned char)s[pos] == b) return pos;
+    }
+    return -1;
+}
+
+static bool char_eq(unsigned char c, unsigned char qc, bool case_sensitive) {
+    return case_sensitive ? c == qc : fold(c) == fold(qc);
+}
+
+static bool is_delimiter(unsigned char c) {
+    return c == '/' || c == '-' || c == '_' || c == '.' || c == ' ' || c == ':' || c == ',';
+}
+
+// 在位置i匹配一个字符能得到的加成
+static int char_bonus(const char *s, isize i) {
+    if (i == 0 || is_delimiter(s[i - 1])) return BONUS_BOUNDARY;
+    unsigned char prev = s[i - 1], cur = s[i];
+    if (prev >= 'a' && prev <= 'z' && cur >= 'A' && cur <= 'Z') return BONUS_CAMEL;
+    if (!(prev >= '0' && prev <= '9') && cur >= '0' && cur <= '9') return BONUS_CAMEL;
+    return 0;
+}
+
+// 匹配并打分，不是子序列时返回-1
+static int query_score(const char *s, isize len, const fuzzy_query *q) {
+    isize qlen = q->len;
+    // 向前找每个查询字符第一次出现的位置，得到匹配结束的地方
+    isize pos = 0;
+    for (isize qi = 0; qi < qlen; qi++) {
+        unsigned char c = q->str[qi];
+        unsigned char a = q->case_sensitive ? c : fold(c);
+        unsigned char b = q->case_sensitive ? c : (a >= 'a' && a <= 'z' ? a - ('a' - 'A') : a);
+        if ((pos = find_char(s, len, pos, a, b)) < 0) return -1;
+        pos++;
+    }
+    // 再从结束的地方向后找，得到最短的一段
+    isize end = pos, start = end;
+    for (isize qi = qlen - 1; qi >= 0; start--) {
+        if (char_eq(s[start - 1], q->str[qi], q->case_sensitive)) qi--;
+    }
+    int   score = 0, consecutive = 0, first_bonus = 0;
+    bool  in_gap = false;
+    isize qi     = 0;
+    for (isize i = start; i < end; i++) {
+        if (qi < qlen && char_eq(s[i], q->str[qi], q->case_sensitive)) {
+            int bonus = char_bonus(s, i);
+            if (consecutive == 0) {
+                first_bonus = bonus;
+            } else { // 连在一起的字符沿用这一段开头的加成
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus) first_bonus = bonus;
+                if (bonus < first_bonus) bonus = first_bonus;
+                if (bonus < BONUS_CONSECUTIVE) bonus = BONUS_CONSECUTIVE;
+            }
+            score  += SCORE_MATCH + (qi == 0 ? bonus * BONUS_FIRST_MUL : bonus);
+            in_gap  = false;
+            consecutive++;
+            qi++;
+        } else {
+            score       += in_gap ? SCORE_GAP_EXT : SCORE_GAP_START;
+            in_gap       = true;
+            consecutive  = 0;
+            first_bonus  = 0;
+        }
+    }
+    return score < 0 ? 0 : score; // 跳过了很多字符也还是匹配的
+}
+
+// word是query的子序列时返回得分（越高越好），否则返回-1
+int pl_readline_fuzzy_score(const char *word, usize len, const char *query) {
+    fuzzy_query q;
+    query_init(&q, query);
+    if ((string_mask(word, len) & q.mask) != q.mask) return -1;
+    return query_score(word, len, &q);
+}
+
+static bool hit_better(const fuzzy_hit *a, const fuzzy_hit *b) {
+    if (a->score != b->score) return a->score > b->score;
+    if (a->len != b->len) return a->len < b->len; // 同分时短的在前
+    return a->order < b->order;                   // 再按字典序
+}
+
+static void heap_down(fuzzy_heap *heap, usize i) {
+    for (;;) {
+        usize worst = i, l = i * 2 + 1, r = l + 1;
+        if (l < heap->count && hit_better(&heap->hits[worst], &heap->hits[l])) worst = l;
+        if (r < heap->count && hit_better(&heap->hits[worst], &heap->hits[r])) worst = r;
+        if (worst == i) return;
+        fuzzy_hit tmp     = heap->hits[i];
+        heap->hits[i]     = heap->hits[worst];
+        heap->hits[worst] = tmp;
+        i                 = worst;
+    }
+}
+
+static void heap_push(fuzzy_heap *heap, const fuzzy_hit *hit) {
+    if (heap->count < heap->k) {
+        usize i = heap->count++;
+        while (i && hit_better(&heap->hits[(i - 1) / 2], hit)) {
+            heap->hits[i] = heap->hits[(i - 1) / 2];
+            i             = (i - 1) / 2;
+        }
+        heap->hits[i] = *hit;
+    } else if (heap->k && hit_better(hit, &heap->hits[0])) {
+        heap->hits[0] = *hit;
+        heap_down(heap, 0);
+    }
+}
+
+static void consider(fuzzy_heap *heap, const fuzzy_query *q, const pl_readline_word *word,
+                     uint32_t len, usize order) {
+    int score = query_score(word->word, len, q);
+    if (score < 0) return;
+    fuzzy_hit hit = {score, len, order, word};
+    heap_push(heap, &hit);
+}
+
+// 把dict展开到索引里，原来的内容丢掉
+static bool index_fill(pl_readline_fuzzy_t fuzzy, pl_readline_dict_t dict) {
+    fuzzy->built = false;
+    if (!fuzzy->words && !(fuzzy->words = pl_readline_word_maker_init())) return false;
+    pl_readline_word_maker_clear(fuzzy->words);
+    pl_readline_dict_collect(dict, "", 0, true, fuzzy->words);
+    usize count = fuzzy->words->len;
+    if (count > fuzzy->cap) {
+        uint64_t *masks = realloc(fuzzy->masks, count * sizeof(uint64_t));
+        if (masks) fuzzy->masks = masks;
+        uint32_t *lens = realloc(fuzzy->lens, count * sizeof(uint32_t));
+        if (lens) fuzzy->lens = lens;
+        if (!masks || !lens) return false;
+        fuzzy->cap = count;
+    }
+    for (usize i = 0; i < count; i++) {
+        const char *word = fuzzy->words->words[i].word;
+        fuzzy->lens[i]   = strlen(word);
+        fuzzy->masks[i]  = string_mask(word, fuzzy->lens[i]);
+    }
+    fuzzy->built = true;
+    return true;
+}
+
+// 为不再修改的dict（共用词库的一个版本）建立索引，内存不足时返回NULL
+pl_readline_fuzzy_t pl_readline_fuzzy_index_new(pl_readline_dict_t dict) {
+    pl_readline_fuzzy_t fuzzy = calloc(1, sizeof(struct pl_readline_fuzzy));
+    if (fuzzy && !index_fill(fuzzy, dict)) {
+        pl_readline_fuzzy_index_free(fuzzy);
+        return NULL;
+    }
+    return fuzzy;
+}
+
+void pl_readline_fuzzy_index_free(pl_readline_fuzzy_t fuzzy) {
+    if (!fuzzy) return;
+    if (fuzzy->words) pl_readline_word_maker_destroy(fuzzy->words);
+    free(fuzzy->masks);
+    free(fuzzy->lens);
+    free(fuzzy);
+}
+
+usize pl_readline_fuzzy_index_memory(pl_readline_fuzzy_t fuzzy) {
+    if (!fuzzy) return 0;
+    usize size = sizeof(struct pl_readline_fuzzy) + fuzzy->cap * (sizeof(uint64_t) + sizeof(uint32_t));
+    if (fuzzy->words) size += pl_readline_word_maker_memory(fuzzy->words);
+    return size;
+}
+
+// 当前词库的索引：共用的词库用版本上的，实例自己的词库没变时沿用上一次的；内存不足时返回NULL
+static pl_readline_fuzzy_t fuzzy_index(_self) {
+#if PL_ENABLE_SHARED_DICT
+    if (self->dict_version) return pl_readline_dict_version_fuzzy(self->dict_version);
+#endif
+    pl_readline_fuzzy_t fuzzy = self->fuzzy;
+    if (!fuzzy && !(fuzzy = self->fuzzy = calloc(1, sizeof(struct pl_readline_fuzzy)))) return NULL;
+    if (fuzzy->built && fuzzy->generation == self->color_generation) return fuzzy;
+    if (!index_fill(fuzzy, self->dict)) return NULL;
+    fuzzy->generation = self->color_generation;
+    return fuzzy;
+}
+
+// 在索引里找：先按字符集合一批批地筛，剩下的再打分
+static void fuzzy_scan(pl_readline_fuzzy_t fuzzy, const fuzzy_query *q, bool is_first,
+                       fuzzy_heap *heap) {
+    const pl_readline_word *words = fuzzy->words->words;
+    const uint64_t         *masks = fuzzy->masks;
+    usize                   count = fuzzy->words->len;
+    usize                   i     = 0;
+#if defined(FUZZY_AVX2)
+    __m256i qv = _mm256_set1_epi64x((long long)q->mask);
+    for (; i + 4 <= count; i += 4) {
+        __m256i  v    = _mm256_loadu_si256((const __m256i *)(masks + i));
+        __m256i  eq   = _mm256_cmpeq_epi64(_mm256_and_si256(v, qv), qv);
+        unsigned bits = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        for (; bits; bits &= bits - 1) {
+            usize j = i + __builtin_ctz(bits);
+            if (is_first || !words[j].first) consider(heap, q, &words[j], fuzzy->lens[j], j);
+        }
+    }
+#elif defined(FUZZY_SSE2)
+    __m128i qv = _mm_set1_epi64x((long long)q->mask);
+    for (; i + 2 <= count; i += 2) {
+        __m128i v  = _mm_loadu_si128((const __m128i *)(masks + i));
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(v, qv), qv); // SSE2没有64位比较，两半都相等才算
+        unsigned m    = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(eq));
+        unsigned bits = ((m & 3) == 3) | (((m >> 2) & 3) == 3) << 1;
+        for (; bits; bits &= bits - 1) {
+            usize j = i + __builtin_ctz(bits);
+            if (is_first || !words[j].first) consider(heap, q, &words[j], fuzzy->lens[j], j);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if ((masks[i] & q->mask) == q->mask && (is_first || !words[i].first)) {
+            consider(heap, q, &words[i], fuzzy->lens[i], i);
+        }
+    }
+}
+
+// 用query模糊匹配词库和extra（回调给出的候选词，可以为NULL），得分最高的至多k个按从高到低放进out，
+// 返回个数；out里的词在词库或extra变化之前有效
+usize pl_readline_fuzzy_match(_self, const char *query, bool is_first, pl_readline_words_t extra,
+                              pl_readline_word *out, usize k) {
+    fuzzy_hit  hits[PL_READLINE_FUZZY_TOP];
+    fuzzy_heap heap = {hits, 0, k < PL_READLINE_FUZZY_TOP ? k : PL_READLINE_FUZZY_TOP};
+    fuzzy_query q;
+    query_init(&q, query);
+    pl_readline_dict_t  dict  = pl_readline_dict_current(self);
+    pl_readline_fuzzy_t index = fuzzy_index(self);
+    if (index) fuzzy_scan(index, &q, is_first, &heap);
+    for (isize i = 0; extra && i < extra->len; i++) {
+        const pl_readline_word *word = &extra->words[i];
+        pl_readline_word        info;
+        usize                   len = strlen(word->word);
+        if ((string_mask(word->word, len) & q.mask) != q.mask || (!is_first && word->first) ||
+            pl_readline_dict_lookup(dict, word->word, len, &info)) // 词库里已经有了
+            continue;
+        consider(&heap, &q, word, len, (usize)-1 / 2 + i);
+    }
+    usize count = heap.count;
+    while (heap.count) { // 每次取出最差的放到最后
+        out[heap.count - 1] = *heap.hits[0].word;
+        heap.hits[0]        = heap.hits[--heap.count];
+        heap_down(&heap, 0);
+    }
+    return count;
+}
+
+// 打开或关闭模糊补全
+void pl_readline_set_fuzzy(_self, bool enable) {
+    self->fuzzy_mode = enable;
+    if (!enable) pl_readline_fuzzy_free(self);
+}
+
+// 只释放实例自己的索引，共用词库版本上的随版本释放
+void pl_readline_fuzzy_free(_self) {
+    pl_readline_fuzzy_index_free(self->fuzzy);
+    self->fuzzy = NULL;
+}
+
+usize pl_readline_fuzzy_memory(_self) {
+    return pl_readline_fuzzy_index_memory(self->fuzzy);
+}
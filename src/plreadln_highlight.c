@@ -0,0 +1,191 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_highlight.c : 由应用程序返回着色区间的高亮方式
+//
+// 设置了 pl_readline_highlight 回调后，着色不再按单词查词库，
+// 而是让应用程序一次性给出 (偏移, 长度, 颜色) 区间。
+// 编辑之后只把受损的那一段重新交给回调，其余区间平移后继续使用。
+
+#include "pl_readline.h"
+#include <string.h>
+
+struct pl_readline_spans {
+    pl_readline_span *spans;         // 高亮区间，按位置排序
+    isize             count;
+    isize             cap;
+    pl_readline_span *scratch;       // 本次回调新给出的区间
+    isize             scratch_count;
+    isize             scratch_cap;
+    isize             from;          // 需要重新交给高亮回调的范围
+    isize             to;
+};
+
+struct pl_readline_span_sink {
+    pl_readline_t self;
+    isize         base; // 交给回调的片段在行内的起始位置
+    isize         len;  // 片段长度
+};
+
+static bool spans_reserve(pl_readline_span **spans, isize *cap, isize len) {
+    if (len <= *cap) return true;
+    isize new_cap = *cap ? *cap : 8;
+    while (new_cap < len) {
+        new_cap *= 2;
+    }
+    pl_readline_span *p = realloc(*spans, new_cap * sizeof(pl_readline_span));
+    if (!p) return false;
+    *spans = p;
+    *cap   = new_cap;
+    return true;
+}
+
+void pl_readline_span_add(pl_readline_span_sink_t sink, size_t offset, size_t len, int color) {
+    pl_readline_spans_t spans = sink->self->spans;
+    if (offset >= (size_t)sink->len) return;
+    if (len > (size_t)sink->len - offset) len = sink->len - offset; // 超出片段的部分不要
+    if (!len) return;
+    if (!spans_reserve(&spans->scratch, &spans->scratch_cap, spans->scratch_count + 1)) return;
+    // 回调一般按顺序给出区间，插入排序足够了
+    pl_readline_span span = {.start = sink->base + offset, .len = len, .color = color};
+    isize            i    = spans->scratch_count++;
+    while (i && spans->scratch[i - 1].start > span.start) {
+        spans->scratch[i] = spans->scratch[i - 1];
+        i--;
+    }
+    spans->scratch[i] = span;
+}
+
+// 编辑之后调整区间：被编辑碰到的区间丢掉，后面的平移，
+// 再把 [from, to)（新坐标）和之前还没处理的受损范围合并。
+// 还没有创建区间时整行都要交给回调，不用记
+void pl_readline_spans_update(_self, isize pos, isize removed, isize inserted, isize from,
+                              isize to) {
+    pl_readline_spans_t spans = self->spans;
+    if (!self->pl_readline_highlight || !spans) return;
+    isize delta = inserted - removed;
+    if (spans->to > spans->from) {
+        isize a = spans->from < pos ? spans->from : spans->from + delta;
+        isize b = spans->to <= pos ? spans->to : spans->to + delta;
+        if (a < pos && spans->from >= pos) a = pos;
+        if (b < pos) b = pos;
+        if (a < from) from = a;
+        if (b > to) to = b;
+    }
+    isize n = 0;
+    for (isize i = 0; i < spans->count; i++) {
+        pl_readline_span span = spans->spans[i];
+        if (span.start >= pos + removed) {
+            span.start += delta;
+        } else if (span.start + span.len > pos) {
+            continue; // 和编辑区域重叠
+        }
+        if (span.start < to && span.start + span.len > from) { // 落在受损范围内，范围扩大到整个区间
+            if (span.start < from) from = span.start;
+            if (span.start + span.len > to) to = span.start + span.len;
+            continue;
+        }
+        spans->spans[n++] = span;
+    }
+    spans->count = n;
+    spans->from  = from;
+    spans->to    = to > self->length ? self->length : to;
+    if (from < self->dirty_from) self->dirty_from = from;
+}
+
+void pl_readline_spans_reset(_self) {
+    pl_readline_spans_t spans = self->spans;
+    if (!spans) return;
+    spans->count = 0;
+    spans->from  = 0;
+    spans->to    = self->length;
+}
+
+// 把受损的那一段交给高亮回调，新得到的区间插回去
+void pl_readline_spans_refresh(_self) {
+    if (!self->pl_readline_highlight) return;
+    pl_readline_spans_t spans = self->spans;
+    if (!spans) {
+        if (!(spans = calloc(1, sizeof(struct pl_readline_spans)))) return;
+        spans->to   = self->length; // 之前没有区间，整行交给回调
+        self->spans = spans;
+    }
+    if (spans->to <= spans->from) return;
+    isize len = spans->to - spans->from;
+    char *buf = malloc(len + 1);
+    if (!buf) return;
+    pl_readline_buffer_copy(self, spans->from, spans->to, buf);
+    buf[len] = '\0';
+
+    struct pl_readline_span_sink sink = {.self = self, .base = spans->from, .len = len};
+    spans->scratch_count              = 0;
+    self->pl_readline_highlight(buf, len, &sink);
+    free(buf);
+
+    isize count = spans->scratch_count;
+    if (count && spans_reserve(&spans->spans, &spans->cap, spans->count + count)) {
+        isize at = 0;
+        while (at < spans->count && spans->spans[at].start < spans->from) {
+            at++;
+        }
+        memmove(spans->spans + at + count, spans->spans + at,
+                (spans->count - at) * sizeof(pl_readline_span));
+        memcpy(spans->spans + at, spans->scratch, count * sizeof(pl_readline_span));
+        spans->count += count;
+    }
+    if (spans->from < self->dirty_from) self->dirty_from = spans->from;
+    spans->from = spans->to = 0;
+}
+
+// 用高亮区间给 [from, length) 的单元着色
+void pl_readline_spans_paint(_self, pl_readline_cell *cells, isize from) {
+    pl_readline_spans_t spans = self->spans;
+    for (isize i = 0; spans && i < spans->count; i++) {
+        pl_readline_span *span = &spans->spans[i];
+        isize             end  = span->start + span->len;
+        if (end <= from) continue;
+        for (isize j = span->start < from ? from : span->start; j < end && j < self->length; j++) {
+            cells[j].color = span->color;
+        }
+    }
+}
+
+// 占用的内存（字节）
+usize pl_readline_spans_memory(_self) {
+    pl_readline_spans_t spans = self->spans;
+    if (!spans) return 0;
+    return sizeof(struct pl_readline_spans) +
+           (spans->cap + spans->scratch_cap) * sizeof(pl_readline_span);
+}
+
+// 一行开始时调用：临时区间总是释放，区间列表太大时才释放
+void pl_readline_spans_trim(_self) {
+    pl_readline_spans_t spans = self->spans;
+    if (!spans) return;
+    free(spans->scratch);
+    spans->scratch       = NULL;
+    spans->scratch_cap   = 0;
+    spans->scratch_count = 0;
+    if (spans->cap * sizeof(pl_readline_span) > PL_READLINE_IDLE_KEEP) {
+        free(spans->spans);
+        spans->spans = NULL;
+        spans->cap   = 0;
+        spans->count = 0;
+    }
+}
+
+void pl_readline_spans_free(_self) {
+    pl_readline_spans_t spans = self->spans;
+    if (!spans) return;
+    free(spans->spans);
+    free(spans->scratch);
+    free(spans);
+    self->spans = NULL;
+}
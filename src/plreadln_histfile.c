@@ -0,0 +1,515 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_histfile.c : 增量写入的历史记录文件
+//
+// pl_readline_history_open 之后，每提交一行就追加到文件末尾，不再等退出时整体重写。
+// 追加的行先攒在内存里，攒够 PL_READLINE_HISTORY_SYNC_COUNT 行或者超过
+// PL_READLINE_HISTORY_SYNC_SECS 秒才在 flock 保护下一次写入并 fsync。
+// 多个进程共用同一个文件时，文件行数过多就在锁内去重、截断并原子地替换掉整个文件。
+//
+// pl_readline_history_share 打开共享模式后，记下已经读到的文件末尾的位置，
+// 每次显示提示符前只读这之后别的进程追加的行并合并进内存，不重新加载整个文件。
+// 文件被别的进程压缩替换掉时，从新文件里找到上次读到的最后一行，接着它往后读。
+
+#define _DEFAULT_SOURCE
+#include "pl_readline.h"
+
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <stdio.h>
+#    include <string.h>
+#    include <sys/file.h>
+#    include <sys/stat.h>
+#    include <time.h>
+#    include <unistd.h>
+
+struct pl_readline_history_file {
+    char  *path;
+    char  *pending;       // 还没写进文件的行，每行以'\n'结尾
+    usize  pending_len;
+    usize  pending_cap;
+    usize  pending_count; // 待写入的行数
+    time_t pending_since; // 第一条待写入的行的时间
+    usize  file_lines;    // 文件中大约有多少行，用来决定什么时候压缩
+
+    bool     shared;       // 是否合并别的进程追加的行
+    off_t    offset;       // 文件中这个位置之前的行都已经读过（或者是自己写的）
+    dev_t    dev;          // 读到offset时文件的设备和inode，变了说明文件被替换了
+    ino_t    ino;
+    uint32_t last_hash;    // offset之前最后一行的哈希和长度，文件被替换时用来找回位置
+    usize    last_len;
+    char    *incoming;     // 读到了但还没合并进内存的行，每行以'\n'结尾
+    usize    incoming_len;
+    usize    incoming_cap;
+};
+
+// 打开并锁住path，如果拿到锁时文件已经被别的进程替换掉了就重新打开
+int pl_readline_open_locked(const char *path, int flags, int op) {
+    for (;;) {
+        int fd = open(path, flags | O_CREAT, 0600);
+        if (fd < 0) return -1;
+        while (flock(fd, op) < 0) {
+            if (errno != EINTR) {
+                close(fd);
+                return -1;
+            }
+        }
+        struct stat fd_st, path_st;
+        if (fstat(fd, &fd_st) == 0 && stat(path, &path_st) == 0 && fd_st.st_ino == path_st.st_ino &&
+            fd_st.st_dev == path_st.st_dev) {
+            return fd;
+        }
+        close(fd); // 锁住的是旧文件
+    }
+}
+
+// 原子地替换文件的第一步：在dest（已经解析过符号链接）旁边建立临时文件tmp（至少 strlen(dest)+5 字节）。
+// 调用者持有lock（打开的是原来的文件）上的排它锁，上次没写完留下的临时文件可以放心删掉；
+// 临时文件一开始就只有自己能读，再改成原来文件的权限和所有者
+int pl_readline_replace_open(const char *dest, int lock, char *tmp) {
+    struct stat st;
+    if (fstat(lock, &st) < 0) return -1;
+    sprintf(tmp, "%s.tmp", dest);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        unlink(tmp);
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) return -1;
+    if (fchown(fd, st.st_uid, st.st_gid) < 0) errno = 0; // 不是root时改不了所有者，不要紧
+    if (fchmod(fd, st.st_mode & 07777) < 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    return fd;
+}
+
+// 第二步：临时文件写好、fsync并关闭了（ok）就换到dest上，否则删掉它
+bool pl_readline_replace_commit(const char *tmp, const char *dest, bool ok) {
+    if (ok && rename(tmp, dest) == 0) return true;
+    unlink(tmp);
+    return false;
+}
+
+static bool write_all(int fd, const char *buf, usize len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 读出整个文件，extra为额外预留的空间，返回的缓冲区以'\0'结尾
+static char *read_all(int fd, usize extra, usize *len) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return NULL;
+    usize cap = st.st_size + extra + 1;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    usize size = 0;
+    for (;;) {
+        if (size + extra + 1 == cap) { // 文件在这期间变长了
+            char *p = realloc(buf, cap * 2);
+            if (!p) break;
+            buf  = p;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + size, cap - extra - 1 - size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size += n;
+    }
+    buf[size] = '\0';
+    *len      = size;
+    return buf;
+}
+
+// 在buf末尾追加一行并补上'\n'
+static bool lines_append(char **buf, usize *buf_len, usize *buf_cap, const char *line, usize len) {
+    if (*buf_len + len + 1 > *buf_cap) {
+        usize cap = *buf_cap ? *buf_cap : 256;
+        while (*buf_len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *p = realloc(*buf, cap);
+        if (!p) return false;
+        *buf     = p;
+        *buf_cap = cap;
+    }
+    memcpy(*buf + *buf_len, line, len);
+    (*buf)[*buf_len + len]  = '\n';
+    *buf_len               += len + 1;
+    return true;
+}
+
+static bool pending_append(pl_readline_history_file_t file, const char *line, usize len) {
+    if (!lines_append(&file->pending, &file->pending_len, &file->pending_cap, line, len))
+        return false;
+    if (!file->pending_count++) file->pending_since = time(NULL);
+    return true;
+}
+
+typedef struct {
+    const char *str;
+    usize       len;
+} line_ref;
+
+static uint32_t line_hash(const char *str, usize len) {
+    uint32_t hash = 2166136261u;
+    for (usize i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// 记下buf（以'\n'结尾）中最后一行，作为读到的位置
+static void share_mark(pl_readline_history_file_t file, const char *buf, usize len) {
+    if (!len) return;
+    usize start = len - 1;
+    while (start && buf[start - 1] != '\n') {
+        start--;
+    }
+    file->last_hash = line_hash(buf + start, len - 1 - start);
+    file->last_len  = len - 1 - start;
+}
+
+// 把text中完整的行放进incoming，返回用掉的字节数（不完整的最后一行留到下次）
+static usize share_collect(pl_readline_history_file_t file, const char *text, usize len) {
+    usize used = 0;
+    for (usize i = 0; i < len; i++) {
+        if (text[i] != '\n') continue;
+        if (i > used &&
+            !lines_append(&file->incoming, &file->incoming_len, &file->incoming_cap, text + used,
+                          i - used))
+            break;
+        used = i + 1;
+    }
+    share_mark(file, text, used);
+    return used;
+}
+
+// 文件被替换了（别的进程压缩过），从后往前找上次读到的最后一行，返回它后面的位置
+static usize share_resume(pl_readline_history_file_t file, const char *text, usize len) {
+    if (!file->last_len) return 0; // 之前什么都没读到
+    usize end = len;
+    while (end && text[end - 1] != '\n') {
+        end--; // 跳过不完整的最后一行
+    }
+    while (end) {
+        usize start = end - 1;
+        while (start && text[start - 1] != '\n') {
+            start--;
+        }
+        if (end - 1 - start == file->last_len &&
+            line_hash(text + start, file->last_len) == file->last_hash)
+            return end;
+        end = start;
+    }
+    return len; // 找不到就只看之后追加的
+}
+
+// 在锁内读出别的进程新追加的行，放进incoming
+static void share_pull(pl_readline_history_file_t file, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return;
+    if (st.st_dev == file->dev && st.st_ino == file->ino && st.st_size >= file->offset) {
+        usize len = st.st_size - file->offset;
+        if (!len) return;
+        char *text = malloc(len);
+        if (!text) return;
+        ssize_t n;
+        while ((n = pread(fd, text, len, file->offset)) < 0 && errno == EINTR) {}
+        if (n > 0) file->offset += share_collect(file, text, n);
+        free(text);
+        return;
+    }
+    usize size;
+    char *text = read_all(fd, 0, &size);
+    lseek(fd, 0, SEEK_SET); // 调用者可能还要从头读
+    if (!text) return;
+    usize from   = share_resume(file, text, size);
+    file->offset = from + share_collect(file, text + from, size - from);
+    file->dev    = st.st_dev;
+    file->ino    = st.st_ino;
+    free(text);
+}
+
+// 读到了文件末尾（包括自己刚写的行）
+static void share_seek_end(pl_readline_history_file_t file, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return;
+    file->offset = st.st_size;
+    file->dev    = st.st_dev;
+    file->ino    = st.st_ino;
+}
+
+// 去掉重复的行（保留最后一次出现的位置）并只保留最新的max行，结果写到out
+static usize compact_lines(const line_ref *lines, usize count, usize max, char *out) {
+    usize  size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    isize *set  = malloc(size * sizeof(isize));
+    bool  *keep = calloc(count ? count : 1, sizeof(bool));
+    usize  kept = 0, len = 0;
+    if (!set || !keep) {
+        free(set);
+        free(keep);
+        return 0;
+    }
+    for (usize i = 0; i < size; i++) {
+        set[i] = -1;
+    }
+    for (usize i = count; i-- > 0 && kept < max;) {
+        usize slot = line_hash(lines[i].str, lines[i].len) & (size - 1);
+        for (; set[slot] >= 0; slot = (slot + 1) & (size - 1)) {
+            const line_ref *other = &lines[set[slot]];
+            if (other->len == lines[i].len && !memcmp(other->str, lines[i].str, other->len)) break;
+        }
+        if (set[slot] >= 0) continue; // 后面已经有一样的了
+        set[slot] = i;
+        keep[i]   = true;
+        kept++;
+    }
+    for (usize i = 0; i < count; i++) {
+        if (!keep[i]) continue;
+        memcpy(out + len, lines[i].str, lines[i].len);
+        out[len + lines[i].len]  = '\n';
+        len                     += lines[i].len + 1;
+    }
+    free(set);
+    free(keep);
+    return len;
+}
+
+// 在锁内重写整个文件：去重并截断到 PL_READLINE_HISTORY_FILE_MAX 行，顺便写入还没写的行
+int pl_readline_history_compact(_self) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file) return PL_READLINE_FAILED;
+    int fd = pl_readline_open_locked(file->path, O_RDWR, LOCK_EX);
+    if (fd < 0) return PL_READLINE_FAILED;
+    if (file->shared) share_pull(file, fd); // 压缩会丢掉别的进程新追加的行的位置，先读出来
+    int       status = PL_READLINE_FAILED;
+    usize     size, count = 0, len;
+    char     *text   = read_all(fd, file->pending_len, &size);
+    char     *out    = NULL;
+    line_ref *lines  = NULL;
+    char     *target = realpath(file->path, NULL); // 替换的是符号链接指向的文件
+    char     *dest   = target ? target : file->path;
+    char     *tmp    = malloc(strlen(dest) + 5);
+    if (!text || !tmp) goto done;
+    if (size && text[size - 1] != '\n') text[size++] = '\n'; // 上次写到一半的行
+    if (file->pending_len) memcpy(text + size, file->pending, file->pending_len);
+    size += file->pending_len;
+    for (usize i = 0; i < size; i++) {
+        if (text[i] == '\n') count++;
+    }
+    lines = malloc((count ? count : 1) * sizeof(line_ref));
+    out   = malloc(size + 1);
+    if (!lines || !out) goto done;
+    count = 0;
+    for (usize i = 0, start = 0; i < size; i++) {
+        if (text[i] != '\n') continue;
+        if (i > start) lines[count++] = (line_ref){text + start, i - start};
+        start = i + 1;
+    }
+    len = compact_lines(lines, count, PL_READLINE_HISTORY_FILE_MAX, out);
+
+    // 先写到临时文件，再原子地替换掉原来的文件
+    int tmp_fd = pl_readline_replace_open(dest, fd, tmp);
+    if (tmp_fd < 0) goto done;
+    bool ok = write_all(tmp_fd, out, len) && fsync(tmp_fd) == 0;
+    if (ok && file->shared) share_seek_end(file, tmp_fd);
+    close(tmp_fd);
+    if (!pl_readline_replace_commit(tmp, dest, ok)) goto done;
+    if (file->shared) share_mark(file, out, len);
+    file->file_lines    = 0;
+    for (usize i = 0; i < len; i++) {
+        if (out[i] == '\n') file->file_lines++;
+    }
+    file->pending_len   = 0;
+    file->pending_count = 0;
+    status              = PL_READLINE_SUCCESS;
+
+done:
+    close(fd); // 同时释放锁
+    free(text);
+    free(out);
+    free(lines);
+    free(tmp);
+    free(target);
+    return status;
+}
+
+// 把攒着的行追加到文件里并fsync
+int pl_readline_history_sync(_self) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file) return PL_READLINE_FAILED;
+    if (!file->pending_count) return PL_READLINE_SUCCESS;
+    if (file->file_lines + file->pending_count > PL_READLINE_HISTORY_FILE_MAX * 2) {
+        return pl_readline_history_compact(self); // 文件太大了，顺便压缩
+    }
+    int fd = pl_readline_open_locked(file->path, (file->shared ? O_RDWR : O_WRONLY) | O_APPEND,
+                                     LOCK_EX);
+    if (fd < 0) return PL_READLINE_FAILED;
+    if (file->shared) share_pull(file, fd); // 自己的行写进去之前先读走别人追加的
+    bool        ok = write_all(fd, file->pending, file->pending_len) && fsync(fd) == 0;
+    if (ok && file->shared) {
+        share_seek_end(file, fd);
+        share_mark(file, file->pending, file->pending_len);
+    }
+    struct stat st;
+    if (ok && fstat(fd, &st) == 0) {
+        // 别的进程也在追加，按这一批的平均行长估计一下文件现在的行数
+        usize estimate = st.st_size / (file->pending_len / file->pending_count);
+        if (estimate > file->file_lines + file->pending_count) {
+            file->file_lines = estimate - file->pending_count;
+        }
+    }
+    close(fd);
+    if (!ok) return PL_READLINE_FAILED; // 留着下次再试
+    file->file_lines    += file->pending_count;
+    file->pending_len    = 0;
+    file->pending_count  = 0;
+    return PL_READLINE_SUCCESS;
+}
+
+// 提交了一行，攒够了就写入文件
+void pl_readline_history_append(_self, const char *line, usize len) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file || !len || !pending_append(file, line, len)) return;
+    if (file->shared) {
+        pl_readline_history_sync(self); // 共享时马上写入，别的会话下次显示提示符就能看到
+    } else {
+        pl_readline_history_tick(self);
+    }
+}
+
+// 检查有没有到该写入文件的时候
+void pl_readline_history_tick(_self) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file || !file->pending_count) return;
+    if (file->pending_count >= PL_READLINE_HISTORY_SYNC_COUNT ||
+        time(NULL) - file->pending_since >= PL_READLINE_HISTORY_SYNC_SECS) {
+        pl_readline_history_sync(self);
+    }
+}
+
+// 读入文件中的历史记录，之后提交的每一行都追加到这个文件
+int pl_readline_history_open(_self, const char *filename) {
+    pl_readline_history_close(self);
+    pl_readline_history_file_t file = calloc(1, sizeof(struct pl_readline_history_file));
+    if (!file) return PL_READLINE_FAILED;
+    file->path = strdup(filename);
+    int fd     = file->path ? pl_readline_open_locked(filename, O_RDONLY, LOCK_SH) : -1;
+    char magic[sizeof(PL_READLINE_HISTORY_MAGIC) - 1];
+    if (fd >= 0 && pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+        !memcmp(magic, PL_READLINE_HISTORY_MAGIC, sizeof(magic))) {
+        close(fd); // 二进制格式不能直接追加，用 pl_readline_load_history 加载
+        fd = -1;
+    }
+    if (fd < 0) {
+        free(file->path);
+        free(file);
+        return PL_READLINE_FAILED;
+    }
+    // 只需要知道文件是否超过了压缩的阈值，不用数完所有的行
+    file->file_lines =
+        pl_readline_history_map(self->history, fd, PL_READLINE_HISTORY_FILE_MAX * 2 + 1);
+    self->history_file = file;
+    flock(fd, LOCK_UN); // 映射会一直引用这个打开的文件，光close不会释放锁
+    close(fd);
+    return PL_READLINE_SUCCESS;
+}
+
+// 打开或关闭共享模式，打开时从文件现在的末尾开始接收别的进程追加的行
+int pl_readline_history_share(_self, bool enable) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file) return PL_READLINE_FAILED;
+    if (!enable || file->shared) {
+        file->shared = enable;
+        return PL_READLINE_SUCCESS;
+    }
+    pl_readline_history_sync(self); // 之前攒的行不能算成别人的
+    int fd = pl_readline_open_locked(file->path, O_RDONLY, LOCK_SH);
+    if (fd < 0) return PL_READLINE_FAILED;
+    share_seek_end(file, fd);
+    // 只读文件末尾的一小段，找出最后一行
+    char    tail[4096];
+    off_t   from = file->offset > (off_t)sizeof(tail) ? file->offset - (off_t)sizeof(tail) : 0;
+    ssize_t n    = pread(fd, tail, file->offset - from, from);
+    while (n > 0 && tail[n - 1] != '\n') {
+        n--;
+    }
+    if (n > 0) share_mark(file, tail, n);
+    close(fd);
+    file->shared = true;
+    return PL_READLINE_SUCCESS;
+}
+
+// 把别的进程新追加的行合并进历史记录，没有变化时只需要一次stat
+void pl_readline_history_refresh(_self) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file || !file->shared || self->history_idx) return; // 正在翻看时下标不能变
+    struct stat st;
+    bool        changed = stat(file->path, &st) == 0 &&
+                   (st.st_dev != file->dev || st.st_ino != file->ino || st.st_size != file->offset);
+    if (!changed && !file->incoming_len) return;
+    if (changed) {
+        int fd = pl_readline_open_locked(file->path, O_RDONLY, LOCK_SH);
+        if (fd >= 0) {
+            share_pull(file, fd);
+            close(fd);
+        }
+    }
+    time_t now = time(NULL);
+    for (usize i = 0, start = 0; i < file->incoming_len; i++) {
+        if (file->incoming[i] != '\n') continue;
+        bool added;
+        if (pl_readline_history_add(self->history, file->incoming + start, i - start, &added) &&
+            added) {
+            pl_readline_history_meta meta = {.time = now};
+            pl_readline_history_set_meta(self->history,
+                                         pl_readline_history_count(self->history) - 1, &meta);
+            pl_readline_search_index_add(self);
+        }
+        start = i + 1;
+    }
+    file->incoming_len = 0;
+}
+
+// 占用的内存（字节）
+usize pl_readline_history_file_memory(_self) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file) return 0;
+    return sizeof(struct pl_readline_history_file) + strlen(file->path) + 1 + file->pending_cap +
+           file->incoming_cap;
+}
+
+// 写入还没写的行，不再追加
+void pl_readline_history_close(_self) {
+    pl_readline_history_file_t file = self->history_file;
+    if (!file) return;
+    pl_readline_history_sync(self);
+    free(file->path);
+    free(file->pending);
+    free(file->incoming);
+    free(file);
+    self->history_file = NULL;
+}
+#endif
@@ -9,67 +9,1086 @@
 //
 
 // pl_readline_history.c : 历史记录功能
+//
+// 历史记录是一个环形数组，每一项只记录字符串的编号。按下标访问、追加、淘汰最旧的一项都是 O(1)。
+// 字符串是驻留的：用哈希表按内容查找，相同的命令（和工作目录）只存一份，带引用计数。
+// 引用计数归零的字符串先留在池中，池满时再把还在用的字符串一次性搬到新的池里。
+// 每条记录有一个添加时分配、之后不变的序号，去重时从中间删掉记录也不会影响别的记录的序号。
+//
+// 从文件加载时直接 mmap 整个文件，从末尾往前只索引需要的那些行，
+// 这些记录直接指向映射的内存，被修改时才复制到字符串池里。
+// 二进制格式的文件带有记录偏移的索引，连换行符都不用找。
 
+#define _GNU_SOURCE
 #include "pl_readline.h"
 #include <stdio.h>
 #include <string.h>
+#if PL_ENABLE_POSIX
+#    include <time.h>
+#endif
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+#    include <fcntl.h>
+#    include <sys/file.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+// 驻留的字符串：内容相同的字符串只存一份，靠引用计数回收
+typedef struct pl_readline_history_atom {
+    usize    offset; // 在字符串池（或映射的文件）中的偏移，空闲时是下一个空闲项
+    uint32_t len;    // 字符串长度（不含结束符）
+    uint32_t refs;   // 引用计数，为0时是空闲项
+    uint32_t hash;
+    bool     mapped; // 是否指向映射的文件
+    bool     seen;   // 去重时的标记
+} pl_readline_history_atom;
+
+typedef struct pl_readline_history_entry {
+    uint32_t line;   // 字符串的编号，0为空字符串
+    uint32_t cwd;    // 执行时的工作目录
+    uint64_t seq;    // 序号，添加时分配，之后不变
+    int64_t  time;   // 提交的时间
+    int32_t  status; // 退出状态
+} pl_readline_history_entry;
+
+// 删掉的一条记录，内容的字符串还留着
+typedef struct pl_readline_history_gone {
+    uint64_t seq;
+    uint32_t line;
+} pl_readline_history_gone;
+
+struct pl_readline_history {
+    pl_readline_history_entry *ring;  // 环形数组
+    usize                      cap;   // 环形数组的容量（不超过max）
+    usize                      head;  // 最旧一项的位置
+    usize                      count; // 记录数
+    usize                      max;   // 最多保存的记录数
+    int                        dups;  // 重复记录的处理方式（PL_READLINE_HISTORY_DUPS_*）
+    pl_readline_history_atom  *atoms; // 所有字符串，atoms[0] 不用
+    uint32_t                   atoms_len;
+    uint32_t                   atoms_cap;
+    uint32_t                   atoms_free; // 空闲项链表
+    uint32_t                  *table;      // 按内容查找字符串编号的哈希表，0为空槽位
+    usize                      table_size; // 2的幂
+    usize                      table_used;
+    char                      *pool; // 字符串池
+    usize                      pool_len;
+    usize                      pool_cap;
+    usize                      pool_live; // 池中还在使用的字节数
+    char                      *map;       // 映射的历史记录文件
+    usize                      map_len;
+    usize                      map_refs;     // 还指向映射的字符串数，为0时解除映射
+    const char                *bloom;        // 二进制文件中的布隆过滤器（在映射中）
+    usize                      bloom_bits;   // 布隆过滤器的位数，是2的幂
+    uint32_t                   bloom_hashes; // 每个单词设置的位数
+    uint64_t                   next_seq;     // 下一条记录的序号
+    uint64_t                   removed;      // 淘汰和删掉的记录总数
+    pl_readline_history_gone  *gone;         // 最近删掉的 PL_READLINE_HISTORY_GONE 条（环形），按需分配
+    uint64_t                   gone_lost;    // 这之前删掉的记录没有留在 gone 里（没人要或分配失败）
+    uint32_t                   watchers;     // 读 gone 的索引数，为0时删掉的记录不用留着
+    uint32_t                   refs;         // 共用这份历史记录的实例数
+};
+
+pl_readline_history_t pl_readline_history_new(usize max) {
+    pl_readline_history_t history = calloc(1, sizeof(struct pl_readline_history));
+    if (!history) return NULL;
+    history->max  = max;
+    history->refs = 1;
+    return history;
+}
+
+// 多一个实例使用这份历史记录
+pl_readline_history_t pl_readline_history_ref(pl_readline_history_t history) {
+    history->refs++;
+    return history;
+}
+
+// 共用这份历史记录的实例数
+usize pl_readline_history_refs(pl_readline_history_t history) {
+    return history->refs;
+}
+
+static void history_unmap(pl_readline_history_t history) {
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    if (history->map) munmap(history->map, history->map_len);
+#endif
+    history->map      = NULL;
+    history->map_len  = 0;
+    history->map_refs = 0;
+    history->bloom    = NULL;
+}
+
+void pl_readline_history_free(pl_readline_history_t history) {
+    if (!history || --history->refs) return;
+    history_unmap(history);
+    free(history->ring);
+    free(history->atoms);
+    free(history->table);
+    free(history->pool);
+    free(history->gone);
+    free(history);
+}
+
+static pl_readline_history_entry *history_entry(pl_readline_history_t history, usize idx) {
+    return &history->ring[(history->head + idx) % history->cap];
+}
+
+static const char *atom_data(pl_readline_history_t history, uint32_t id, usize *len) {
+    pl_readline_history_atom *atom = &history->atoms[id];
+    if (len) *len = id ? atom->len : 0;
+    if (!id) return "";
+    return (atom->mapped ? history->map : history->pool) + atom->offset;
+}
+
+static uint32_t atom_hash(const char *data, usize len) {
+    uint32_t hash = 2166136261u;
+    for (usize i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// 哈希表中存放id的槽位，没有时是应该放它的空槽位
+static usize table_slot(pl_readline_history_t history, const char *data, usize len,
+                        uint32_t hash) {
+    usize mask = history->table_size - 1;
+    for (usize i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t id = history->table[i];
+        if (!id) return i;
+        pl_readline_history_atom *atom = &history->atoms[id];
+        if (atom->hash == hash && atom->len == len && !memcmp(atom_data(history, id, NULL), data, len))
+            return i;
+    }
+}
+
+static bool table_grow(pl_readline_history_t history) {
+    usize     size  = history->table_size ? history->table_size * 2 : 16;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table) return false;
+    for (usize i = 0; i < history->table_size; i++) {
+        uint32_t id = history->table[i];
+        if (!id) continue;
+        usize j = history->atoms[id].hash & (size - 1);
+        while (table[j]) {
+            j = (j + 1) & (size - 1);
+        }
+        table[j] = id;
+    }
+    free(history->table);
+    history->table      = table;
+    history->table_size = size;
+    return true;
+}
+
+// 从哈希表中删掉id，后面的项往前挪，不留墓碑
+static void table_remove(pl_readline_history_t history, uint32_t id) {
+    usize mask = history->table_size - 1;
+    usize i    = history->atoms[id].hash & mask;
+    while (history->table[i] != id) {
+        i = (i + 1) & mask;
+    }
+    for (usize j = (i + 1) & mask; history->table[j]; j = (j + 1) & mask) {
+        usize k = history->atoms[history->table[j]].hash & mask;
+        if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+            history->table[i] = history->table[j];
+            i                 = j;
+        }
+    }
+    history->table[i] = 0;
+    history->table_used--;
+}
+
+// 把还在使用的字符串搬到新的池里，顺便留出足够的空间
+static bool pool_compact(pl_readline_history_t history, usize need) {
+    usize cap = (history->pool_live + need) * 2;
+    if (cap < 64) cap = 64;
+    char *pool = malloc(cap);
+    if (!pool) return false;
+    usize len = 0;
+    for (uint32_t id = 1; id < history->atoms_len; id++) {
+        pl_readline_history_atom *atom = &history->atoms[id];
+        if (!atom->refs || atom->mapped) continue;
+        memcpy(pool + len, history->pool + atom->offset, atom->len + 1);
+        atom->offset  = len;
+        len          += atom->len + 1;
+    }
+    free(history->pool);
+    history->pool     = pool;
+    history->pool_len = len;
+    history->pool_cap = cap;
+    return true;
+}
+
+// 把字符串复制到池的末尾，返回偏移
+static bool pool_store(pl_readline_history_t history, const char *data, usize len, usize *offset) {
+    if (history->pool_len + len + 1 > history->pool_cap && !pool_compact(history, len + 1))
+        return false;
+    memcpy(history->pool + history->pool_len, data, len);
+    history->pool[history->pool_len + len]  = '\0';
+    *offset                                 = history->pool_len;
+    history->pool_len                      += len + 1;
+    history->pool_live                     += len + 1;
+    return true;
+}
+
+// 取得内容为data的字符串（引用计数加一），没有时新建一个；
+// map_offset不为SIZE_MAX时新建的字符串直接指向映射的文件
+static bool atom_intern(pl_readline_history_t history, const char *data, usize len,
+                        usize map_offset, uint32_t *out) {
+    *out = 0;
+    if (!len) return true;
+    if (len > UINT32_MAX) return false;
+    if ((history->table_used + 1) * 2 > history->table_size && !table_grow(history)) return false;
+    uint32_t hash = atom_hash(data, len);
+    usize    slot = table_slot(history, data, len, hash);
+    if (history->table[slot]) {
+        *out = history->table[slot];
+        history->atoms[*out].refs++;
+        return true;
+    }
+    uint32_t id = history->atoms_free;
+    if (!id) {
+        if (history->atoms_len == UINT32_MAX) return false;
+        if (!history->atoms_len) history->atoms_len = 1; // 0号不用
+        if (history->atoms_len >= history->atoms_cap) {
+            uint32_t cap = history->atoms_cap ? history->atoms_cap * 2 : 8;
+            pl_readline_history_atom *atoms =
+                realloc(history->atoms, cap * sizeof(pl_readline_history_atom));
+            if (!atoms) return false;
+            history->atoms     = atoms;
+            history->atoms_cap = cap;
+        }
+        id = history->atoms_len;
+    }
+    pl_readline_history_atom atom = {.len = len, .refs = 1, .hash = hash};
+    if (map_offset != SIZE_MAX) {
+        atom.offset = map_offset;
+        atom.mapped = true;
+        history->map_refs++;
+    } else if (!pool_store(history, data, len, &atom.offset)) {
+        return false;
+    }
+    if (id == history->atoms_free) {
+        history->atoms_free = history->atoms[id].offset;
+    } else {
+        history->atoms_len++;
+    }
+    history->atoms[id]   = atom;
+    history->table[slot] = id;
+    history->table_used++;
+    *out = id;
+    return true;
+}
+
+static void atom_release(pl_readline_history_t history, uint32_t id) {
+    if (!id) return;
+    pl_readline_history_atom *atom = &history->atoms[id];
+    if (--atom->refs) return;
+    table_remove(history, id);
+    if (atom->mapped) {
+        if (!--history->map_refs) history_unmap(history);
+    } else {
+        history->pool_live -= atom->len + 1;
+    }
+    atom->offset        = history->atoms_free;
+    history->atoms_free = id;
+}
+
+// 把环形数组整理到容量为cap的新数组里，最旧的一项放在最前面
+static bool history_resize(pl_readline_history_t history, usize cap) {
+    pl_readline_history_entry *ring = malloc(cap * sizeof(pl_readline_history_entry));
+    if (!ring) return false;
+    for (usize i = 0; i < history->count; i++) {
+        ring[i] = *history_entry(history, i);
+    }
+    free(history->ring);
+    history->ring = ring;
+    history->cap  = cap;
+    history->head = 0;
+    return true;
+}
+
+// 记录被淘汰或删掉了：有索引要读时，内容的字符串先放进 gone 里，被更新的挤出去时才释放
+static void history_forget(pl_readline_history_t history, uint64_t seq, uint32_t line,
+                           uint32_t cwd) {
+    atom_release(history, cwd);
+    if (history->watchers && !history->gone)
+        history->gone = calloc(PL_READLINE_HISTORY_GONE, sizeof(pl_readline_history_gone));
+    if (!history->gone) {
+        atom_release(history, line);
+        history->gone_lost = ++history->removed;
+        return;
+    }
+    pl_readline_history_gone *gone = &history->gone[history->removed % PL_READLINE_HISTORY_GONE];
+    if (history->removed - history->gone_lost >= PL_READLINE_HISTORY_GONE)
+        atom_release(history, gone->line); // 挤出去的那条
+    gone->seq  = seq;
+    gone->line = line;
+    history->removed++;
+}
+
+// 淘汰最旧的一项
+static void history_evict(pl_readline_history_t history) {
+    pl_readline_history_entry *entry = history_entry(history, 0);
+    history_forget(history, entry->seq, entry->line, entry->cwd);
+    history->head = (history->head + 1) % history->cap;
+    history->count--;
+}
+
+// 在最新的位置腾出一项，满了就淘汰最旧的
+static pl_readline_history_entry *history_push(pl_readline_history_t history) {
+    if (!history->max) return NULL;
+    if (history->count == history->max) {
+        history_evict(history);
+    } else if (history->count == history->cap) {
+        usize cap = history->cap ? history->cap * 2 : 4;
+        if (cap > history->max) cap = history->max;
+        if (!history_resize(history, cap)) return NULL;
+    }
+    pl_readline_history_entry *entry = history_entry(history, history->count);
+    memset(entry, 0, sizeof(*entry));
+    entry->seq = history->next_seq;
+    return entry;
+}
+
+// 放好内容之后才算数
+static void history_commit(pl_readline_history_t history) {
+    history->count++;
+    history->next_seq++;
+}
+
+#define SEQ_DROP ((uint64_t)1 << 63) // 序号的最高位借来当删除标记
+
+// 去掉做了删除标记的记录，其余的保持顺序往前挪
+static void history_sweep(pl_readline_history_t history) {
+    usize kept = 0;
+    for (usize i = 0; i < history->count; i++) {
+        pl_readline_history_entry *entry = history_entry(history, i);
+        if (entry->seq & SEQ_DROP) {
+            history_forget(history, entry->seq & ~SEQ_DROP, entry->line, entry->cwd);
+        } else {
+            *history_entry(history, kept++) = *entry;
+        }
+    }
+    history->count = kept;
+}
+
+// 按当前的方式整理一遍已有的记录，从文件加载之后、修改方式之后调用
+static void history_dedup(pl_readline_history_t history) {
+    if (history->dups == PL_READLINE_HISTORY_DUPS_KEEP || history->count < 2) return;
+    // 从新到旧，见过的（ERASE）或者和后一条相同的（IGNORE）做上删除标记
+    uint32_t next = 0;
+    for (usize i = history->count; i-- > 0;) {
+        pl_readline_history_entry *entry = history_entry(history, i);
+        if (!entry->line) continue;
+        pl_readline_history_atom *atom = &history->atoms[entry->line];
+        if (history->dups == PL_READLINE_HISTORY_DUPS_ERASE ? atom->seen : entry->line == next)
+            entry->seq |= SEQ_DROP;
+        next       = entry->line;
+        atom->seen = true;
+    }
+    for (usize i = 0; i < history->count; i++) {
+        pl_readline_history_entry *entry = history_entry(history, i);
+        if (entry->line) history->atoms[entry->line].seen = false;
+    }
+    history_sweep(history);
+}
+
+// 添加一条记录，added不为NULL时告诉调用者是否真的加了一条（重复的记录可能被忽略）
+bool pl_readline_history_add(pl_readline_history_t history, const char *line, usize len,
+                             bool *added) {
+    uint32_t id;
+    if (added) *added = false;
+    if (!atom_intern(history, line, len, SIZE_MAX, &id)) return false;
+    if (id && history->count) {
+        pl_readline_history_entry *newest = history_entry(history, history->count - 1);
+        if (history->dups == PL_READLINE_HISTORY_DUPS_IGNORE && newest->line == id) {
+            atom_release(history, id); // 和上一条一样，不再添加
+            return true;
+        }
+        if (history->dups == PL_READLINE_HISTORY_DUPS_ERASE && history->atoms[id].refs > 1) {
+            for (usize i = 0; i < history->count; i++) { // 删掉旧的那条
+                pl_readline_history_entry *entry = history_entry(history, i);
+                if (entry->line == id) entry->seq |= SEQ_DROP;
+            }
+            history_sweep(history);
+        }
+    }
+    pl_readline_history_entry *entry = history_push(history);
+    if (!entry) {
+        atom_release(history, id);
+        return false;
+    }
+    entry->line = id;
+    history_commit(history);
+    if (added) *added = true;
+    return true;
+}
+
+void pl_readline_history_set_dups(pl_readline_history_t history, int dups) {
+    history->dups = dups;
+    history_dedup(history);
+}
+
+// 只有内容真的变了才换成新的字符串，没变的记录不会复制
+bool pl_readline_history_replace(pl_readline_history_t history, usize idx, const char *line,
+                                 usize len) {
+    if (idx >= history->count) return false;
+    pl_readline_history_entry *entry = history_entry(history, idx);
+    usize                      old_len;
+    const char                *old = atom_data(history, entry->line, &old_len);
+    if (old_len == len && !memcmp(old, line, len)) return true;
+    uint32_t id;
+    if (!atom_intern(history, line, len, SIZE_MAX, &id)) return false;
+    atom_release(history, entry->line);
+    entry->line = id;
+    return true;
+}
+
+usize pl_readline_history_count(pl_readline_history_t history) {
+    return history->count;
+}
+
+// 最旧一项的序号，没有记录时是下一条记录的序号
+uint64_t pl_readline_history_first_seq(pl_readline_history_t history) {
+    return history->count ? history_entry(history, 0)->seq : history->next_seq;
+}
+
+// 下一条记录的序号，所有记录的序号都比它小
+uint64_t pl_readline_history_end_seq(pl_readline_history_t history) {
+    return history->next_seq;
+}
+
+// 淘汰和删掉的记录总数，变了说明按序号建立的索引里可能有已经不在的记录
+uint64_t pl_readline_history_removed(pl_readline_history_t history) {
+    return history->removed;
+}
+
+// 多一个（watch为true）或少一个按内容删除记录的索引；没有了就放掉 gone 里留着的字符串
+void pl_readline_history_watch(pl_readline_history_t history, bool watch) {
+    if (watch) {
+        history->watchers++;
+        return;
+    }
+    if (--history->watchers || !history->gone) return;
+    uint64_t n = history->removed - history->gone_lost > PL_READLINE_HISTORY_GONE
+                     ? history->removed - PL_READLINE_HISTORY_GONE
+                     : history->gone_lost;
+    for (; n < history->removed; n++) {
+        atom_release(history, history->gone[n % PL_READLINE_HISTORY_GONE].line);
+    }
+    free(history->gone);
+    history->gone      = NULL;
+    history->gone_lost = history->removed;
+}
+
+// 第n条（从0数起）淘汰或删掉的记录的序号和内容的字符串编号，编号在它被挤出 gone 之前有效。
+// 已经被挤出去了返回false，这时只能按序号逐个检查索引里的记录还在不在
+bool pl_readline_history_removed_at(pl_readline_history_t history, uint64_t n, uint64_t *seq,
+                                    uint32_t *line) {
+    if (n >= history->removed || n < history->gone_lost ||
+        history->removed - n > PL_READLINE_HISTORY_GONE)
+        return false;
+    pl_readline_history_gone *gone = &history->gone[n % PL_READLINE_HISTORY_GONE];
+    *seq                           = gone->seq;
+    *line                          = gone->line;
+    return true;
+}
+
+uint64_t pl_readline_history_seq(pl_readline_history_t history, usize idx) {
+    return idx < history->count ? history_entry(history, idx)->seq : history->next_seq;
+}
+
+// 占用的内存（字节），映射的文件不算在内
+usize pl_readline_history_memory(pl_readline_history_t history) {
+    return sizeof(struct pl_readline_history) + history->cap * sizeof(pl_readline_history_entry) +
+           history->atoms_cap * sizeof(pl_readline_history_atom) +
+           history->table_size * sizeof(uint32_t) + history->pool_cap +
+           (history->gone ? PL_READLINE_HISTORY_GONE * sizeof(pl_readline_history_gone) : 0);
+}
+
+// 第一条序号不小于seq的记录的下标
+usize pl_readline_history_lower_bound(pl_readline_history_t history, uint64_t seq) {
+    usize lo = 0, hi = history->count;
+    // 序号一般是连续的，先直接猜一下
+    uint64_t first = pl_readline_history_first_seq(history);
+    if (seq <= first) return 0;
+    if (seq - first < hi && history_entry(history, seq - first)->seq == seq) return seq - first;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (history_entry(history, mid)->seq < seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// 序号为seq的记录的下标，已经不在了返回false
+bool pl_readline_history_find(pl_readline_history_t history, uint64_t seq, usize *idx) {
+    *idx = pl_readline_history_lower_bound(history, seq);
+    return *idx < history->count && history_entry(history, *idx)->seq == seq;
+}
+
+// 第idx条（0为最旧的）记录，在下一次修改历史记录之前有效
+// 从文件映射进来的记录不以'\0'结尾，长度以len为准
+const char *pl_readline_history_get(pl_readline_history_t history, usize idx, usize *len) {
+    if (idx >= history->count) return NULL;
+    return atom_data(history, history_entry(history, idx)->line, len);
+}
 
+// 第idx条记录内容的字符串编号：内容相同的记录编号相同，记录被修改或淘汰之前不变
+uint32_t pl_readline_history_line_id(pl_readline_history_t history, usize idx) {
+    return idx < history->count ? history_entry(history, idx)->line : 0;
+}
 
+// 编号为id的字符串，id必须是某条还在的记录的内容
+const char *pl_readline_history_line(pl_readline_history_t history, uint32_t id, usize *len) {
+    return atom_data(history, id, len);
+}
+
+// 让编号为id的字符串在 pl_readline_history_line_drop 之前一直有效，记录被删掉了也不释放
+void pl_readline_history_line_hold(pl_readline_history_t history, uint32_t id) {
+    if (id) history->atoms[id].refs++;
+}
+
+void pl_readline_history_line_drop(pl_readline_history_t history, uint32_t id) {
+    atom_release(history, id);
+}
+
+bool pl_readline_history_get_meta(pl_readline_history_t history, usize idx,
+                                  pl_readline_history_meta *meta) {
+    if (idx >= history->count) return false;
+    pl_readline_history_entry *entry = history_entry(history, idx);
+    meta->time                       = entry->time;
+    meta->status                     = entry->status;
+    meta->cwd                        = atom_data(history, entry->cwd, &meta->cwd_len);
+    return true;
+}
+
+bool pl_readline_history_set_meta(pl_readline_history_t history, usize idx,
+                                  const pl_readline_history_meta *meta) {
+    if (idx >= history->count) return false;
+    pl_readline_history_entry *entry = history_entry(history, idx);
+    uint32_t                   id;
+    entry->time   = meta->time;
+    entry->status = meta->status;
+    if (!atom_intern(history, meta->cwd ? meta->cwd : "", meta->cwd ? meta->cwd_len : 0, SIZE_MAX,
+                     &id))
+        return false;
+    atom_release(history, entry->cwd);
+    entry->cwd = id;
+    return true;
+}
+
+bool pl_readline_history_set_max(pl_readline_history_t history, usize max) {
+    while (history->count > max) {
+        history_evict(history);
+    }
+    history->max = max;
+    if (history->cap > max) {
+        if (!max) {
+            free(history->ring);
+            history->ring = NULL;
+            history->cap  = 0;
+            history->head = 0;
+        } else if (!history_resize(history, max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 新的一行，把输入行放进历史记录（打开了历史记录文件的话也追加进去）
 int pl_readline_add_history(_self, char *line) {
-    list_prepend(self->history, strdup(line));
+    usize len = strlen(line);
+    bool  added;
+    if (!pl_readline_history_add(self->history, line, len, &added)) return PL_READLINE_FAILED;
+    if (!added) return PL_READLINE_SUCCESS; // 和上一条一样被忽略了，上一条的时间和文件都不动
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    pl_readline_history_append(self, line, len);
+#endif
+#if PL_ENABLE_POSIX
+    pl_readline_history_meta meta = {.time = time(NULL)};
+    pl_readline_history_set_meta(self->history, pl_readline_history_count(self->history) - 1, &meta);
+#endif
+    pl_readline_search_index_add(self);
     return PL_READLINE_SUCCESS;
 }
 
+// 记下最新一条历史记录的退出状态和工作目录（cwd可以为NULL）
+int pl_readline_set_history_status(_self, int status, const char *cwd) {
+    usize                    count = pl_readline_history_count(self->history);
+    pl_readline_history_meta meta;
+    if (!count || !pl_readline_history_get_meta(self->history, count - 1, &meta))
+        return PL_READLINE_FAILED;
+    meta.status  = status;
+    meta.cwd     = cwd;
+    meta.cwd_len = cwd ? strlen(cwd) : 0;
+    return pl_readline_history_set_meta(self->history, count - 1, &meta) ? PL_READLINE_SUCCESS
+                                                                         : PL_READLINE_FAILED;
+}
+
+// 把当前输入行的修改保存到正在查看的那一条上
 int pl_readline_modify_history(_self) {
-    list_t node = list_nth(self->history, self->history_idx);
-    // 当前历史记录肯定不为空，如果为空炸了算了
-    free(node->data);
-    node->data = strdup(self->buffer);
+    const char *line = pl_readline_buffer_view(self);
+    if (self->history_idx && pl_readline_history_refs(self->history) > 1) {
+        return PL_READLINE_SUCCESS; // 共用的历史记录不能改，修改只留在输入行里
+    }
+    if (self->history_idx == 0) { // 还没有提交的输入行，放不下时才重新分配
+        usize len = self->length + 1;
+        if (len > self->history_line_cap) {
+            char *copy = realloc(self->history_line, len);
+            if (!copy) return PL_READLINE_FAILED;
+            self->history_line     = copy;
+            self->history_line_cap = len;
+        }
+        memcpy(self->history_line, line, len);
+        return PL_READLINE_SUCCESS;
+    }
+    usize       idx = pl_readline_history_count(self->history) - self->history_idx;
+    usize       len;
+    const char *old = pl_readline_history_get(self->history, idx, &len);
+    if (old && len == (usize)self->length && !memcmp(old, line, len)) return PL_READLINE_SUCCESS;
+    pl_readline_search_touch(self, pl_readline_history_seq(self->history, idx));
+    pl_readline_prefix_touch(self, pl_readline_history_seq(self->history, idx));
+    return pl_readline_history_replace(self->history, idx, line, self->length)
+               ? PL_READLINE_SUCCESS
+               : PL_READLINE_FAILED;
+}
+
+// 设置重复记录的处理方式，已有的记录也会按新的方式整理
+int pl_readline_set_history_dups(_self, int dups) {
+    if (dups < PL_READLINE_HISTORY_DUPS_KEEP || dups > PL_READLINE_HISTORY_DUPS_ERASE)
+        return PL_READLINE_FAILED;
+    pl_readline_history_set_dups(self->history, dups);
+    return PL_READLINE_SUCCESS;
+}
+
+// 和other共用同一份历史记录（一起增加，谁都不能修改已有的记录），原来的历史记录被丢掉
+int pl_readline_share_history(_self, pl_readline_t other) {
+    if (self->history == other->history) return PL_READLINE_SUCCESS;
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    if (self->history_file) return PL_READLINE_FAILED; // 文件里的记录已经读进原来的历史记录了
+#endif
+    pl_readline_search_free(self); // 按旧的历史记录建立的索引
+    pl_readline_prefix_free(self);
+    pl_readline_history_free(self->history);
+    self->history     = pl_readline_history_ref(other->history);
+    self->history_idx = 0;
+    return PL_READLINE_SUCCESS;
+}
+
+int pl_readline_set_history_max(_self, usize max) {
+    if (!pl_readline_history_set_max(self->history, max)) return PL_READLINE_FAILED;
+    // 正在查看的那一条可能被淘汰了
+    if ((usize)self->history_idx > pl_readline_history_count(self->history)) {
+        self->history_idx = pl_readline_history_count(self->history);
+    }
     return PL_READLINE_SUCCESS;
 }
 #if PL_ENABLE_HISTORY_FILE
-void pl_readline_save_history(_self, const char *filename) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) return;
-    // Write history in reverse (oldest first)
-    list_t node = self->history;
-    // Find the last node
-    while (node && node->next)
-        node = node->next;
-    // Write from last to first, skipping the empty last entry
-    while (node) {
-        if (node->data && ((char *)node->data)[0] != '\0') fprintf(fp, "%s\n", (char *)node->data);
-        node = node->prev;
+// 二进制格式：文件头 | 记录 ... | 记录偏移数组 | 布隆过滤器 | 文件尾
+// 每条记录是 bin_record 后面跟着命令和工作目录（都没有结束符），整数都是本机字节序。
+// 加载时只需要读文件尾和偏移数组的最后一段，不用解析整个文件。
+
+typedef struct bin_record {
+    uint32_t len;     // 命令的长度
+    uint32_t cwd_len; // 工作目录的长度
+    int64_t  time;
+    int32_t  status;
+    uint32_t reserved;
+} bin_record;
+
+typedef struct bin_tail {
+    uint64_t index_offset; // 记录偏移数组（每项uint64_t）的位置
+    uint64_t count;        // 记录数
+    uint64_t bloom_offset; // 布隆过滤器的位置
+    uint64_t bloom_bits;   // 布隆过滤器的位数，是2的幂
+    uint32_t bloom_hashes; // 每个单词设置的位数
+    uint32_t reserved;
+    char     magic[8];
+} bin_tail;
+
+#    define BIN_TAIL_MAGIC   "\177PLHIDX1"
+#    define BLOOM_HASHES     7
+#    define BLOOM_BITS_PER   10 // 每个单词占多少位
+#    define MAGIC_LEN        8
+
+static bool is_binary(const char *data, usize size) {
+    return size >= MAGIC_LEN && !memcmp(data, PL_READLINE_HISTORY_MAGIC, MAGIC_LEN);
+}
+
+static bool bin_tail_read(const char *data, usize size, bin_tail *tail) {
+    if (size < MAGIC_LEN + sizeof(bin_tail)) return false;
+    memcpy(tail, data + size - sizeof(bin_tail), sizeof(bin_tail));
+    usize end = size - sizeof(bin_tail);
+    return !memcmp(tail->magic, BIN_TAIL_MAGIC, MAGIC_LEN) && tail->index_offset <= end &&
+           tail->count <= (end - tail->index_offset) / sizeof(uint64_t);
+}
+
+// 第i条记录，越界时返回false
+static bool bin_record_read(const char *data, usize size, const bin_tail *tail, usize i,
+                            bin_record *rec, usize *offset) {
+    uint64_t off;
+    memcpy(&off, data + tail->index_offset + i * sizeof(uint64_t), sizeof(uint64_t));
+    if (off < MAGIC_LEN || off > size || size - off < sizeof(bin_record)) return false;
+    memcpy(rec, data + off, sizeof(bin_record));
+    if ((uint64_t)rec->len + rec->cwd_len > size - off - sizeof(bin_record)) return false;
+    *offset = off + sizeof(bin_record);
+    return true;
+}
+
+// 单词（以空格分隔）的两个哈希，布隆过滤器用 h1 + i * h2
+static void bloom_hash(const char *word, usize len, uint32_t *h1, uint32_t *h2) {
+    uint64_t hash = 14695981039346656037ull;
+    for (usize i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)word[i]) * 1099511628211ull;
+    }
+    *h1 = (uint32_t)hash;
+    *h2 = (uint32_t)(hash >> 32) | 1;
+}
+
+static bool bloom_test(const char *bloom, usize bits, uint32_t hashes, const char *word, usize len) {
+    uint32_t h1, h2;
+    bloom_hash(word, len, &h1, &h2);
+    for (uint32_t i = 0; i < hashes; i++) {
+        usize bit = (h1 + (usize)i * h2) & (bits - 1);
+        if (!(bloom[bit / 8] & (1 << (bit % 8)))) return false;
+    }
+    return true;
+}
+
+// 统计line中的单词数，bloom不为NULL时顺便把这些单词加进布隆过滤器
+static usize each_word(const char *line, usize len, char *bloom, usize bits) {
+    usize count = 0;
+    for (usize i = 0; i < len;) {
+        while (i < len && line[i] == ' ') {
+            i++;
+        }
+        usize start = i;
+        while (i < len && line[i] != ' ') {
+            i++;
+        }
+        if (i == start) break;
+        count++;
+        if (!bloom) continue;
+        uint32_t h1, h2;
+        bloom_hash(line + start, i - start, &h1, &h2);
+        for (uint32_t k = 0; k < BLOOM_HASHES; k++) {
+            usize bit        = (h1 + (usize)k * h2) & (bits - 1);
+            bloom[bit / 8]  |= 1 << (bit % 8);
+        }
     }
+    return count;
+}
+
+// 从二进制文件加载的记录中是否可能有这个单词，没有加载过二进制文件时总是返回true
+bool pl_readline_history_may_contain(pl_readline_history_t history, const char *word, usize len) {
+    if (!history->bloom) return true;
+    return bloom_test(history->bloom, history->bloom_bits, history->bloom_hashes, word, len);
+}
+
+static bool write_text(pl_readline_history_t history, FILE *fp) {
+    // Write history oldest first, skipping empty entries
+    for (usize i = 0; i < history->count; i++) {
+        usize       len;
+        const char *line = atom_data(history, history_entry(history, i)->line, &len);
+        if (!len) continue;
+        fwrite(line, 1, len, fp);
+        fputc('\n', fp);
+    }
+    return !ferror(fp);
+}
+
+static bool write_binary(pl_readline_history_t history, FILE *fp) {
+    uint64_t *offsets = malloc((history->count ? history->count : 1) * sizeof(uint64_t));
+    if (!offsets) return false;
+    uint64_t pos   = MAGIC_LEN;
+    usize    count = 0, words = 0;
+    fwrite(PL_READLINE_HISTORY_MAGIC, 1, MAGIC_LEN, fp);
+    for (usize i = 0; i < history->count; i++) {
+        pl_readline_history_entry *entry = history_entry(history, i);
+        usize                      len, cwd_len;
+        const char                *line = atom_data(history, entry->line, &len);
+        const char                *cwd  = atom_data(history, entry->cwd, &cwd_len);
+        if (!len) continue;
+        bin_record rec   = {.len = len, .cwd_len = cwd_len, .time = entry->time, .status = entry->status};
+        offsets[count++] = pos;
+        fwrite(&rec, sizeof(rec), 1, fp);
+        fwrite(line, 1, len, fp);
+        fwrite(cwd, 1, cwd_len, fp);
+        pos   += sizeof(rec) + len + cwd_len;
+        words += each_word(line, len, NULL, 0);
+    }
+    static const char pad[8] = {0};
+    fwrite(pad, 1, (8 - pos % 8) % 8, fp); // 偏移数组按8字节对齐
+    pos += (8 - pos % 8) % 8;
+
+    bin_tail tail = {.index_offset = pos, .count = count, .bloom_hashes = BLOOM_HASHES};
+    memcpy(tail.magic, BIN_TAIL_MAGIC, MAGIC_LEN);
+    fwrite(offsets, sizeof(uint64_t), count, fp);
+    pos             += count * sizeof(uint64_t);
+    tail.bloom_bits  = 64;
+    while (tail.bloom_bits < words * BLOOM_BITS_PER) {
+        tail.bloom_bits *= 2;
+    }
+    tail.bloom_offset = pos;
+    char *bloom       = calloc(tail.bloom_bits / 8, 1);
+    if (bloom) {
+        for (usize i = 0; i < history->count; i++) {
+            usize       len;
+            const char *line = atom_data(history, history_entry(history, i)->line, &len);
+            each_word(line, len, bloom, tail.bloom_bits);
+        }
+        fwrite(bloom, 1, tail.bloom_bits / 8, fp);
+    } else {
+        tail.bloom_bits = 0; // 没有布隆过滤器
+    }
+    fwrite(&tail, sizeof(tail), 1, fp);
+    free(bloom);
+    free(offsets);
+    return bloom && !ferror(fp);
+}
+
+// 文件是什么格式，不存在时按文本格式
+static int file_format(const char *filename) {
+    char  magic[MAGIC_LEN];
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return PL_READLINE_HISTORY_TEXT;
+    usize n = fread(magic, 1, MAGIC_LEN, fp);
     fclose(fp);
+    return is_binary(magic, n) ? PL_READLINE_HISTORY_BINARY : PL_READLINE_HISTORY_TEXT;
 }
 
-void pl_readline_load_history(_self, const char *filename) {
-    FILE *fp = fopen(filename, "r");
+static bool history_write(pl_readline_history_t history, FILE *fp, int format) {
+    bool ok = format == PL_READLINE_HISTORY_BINARY ? write_binary(history, fp)
+                                                   : write_text(history, fp);
+    return fflush(fp) == 0 && ok;
+}
+
+#    if PL_ENABLE_POSIX
+// 历史记录可能还映射着这个文件，不能直接截断，先写到临时文件再替换（见 pl_readline_replace_open）。
+// 替换的是符号链接指向的文件；整个过程持有和 plreadln_histfile.c 一样的锁，
+// 正在追加的会话不会把行写进被换掉的文件里
+static bool history_save_file(pl_readline_history_t history, const char *filename, int format) {
+    char       *target = realpath(filename, NULL); // 文件还不存在时为NULL
+    const char *dest   = target ? target : filename;
+    char       *path   = malloc(strlen(dest) + 5);
+    int         lock   = path ? pl_readline_open_locked(dest, O_RDONLY, LOCK_EX) : -1;
+    int         fd     = lock < 0 ? -1 : pl_readline_replace_open(dest, lock, path);
+    bool        ok     = false;
+    if (fd < 0) goto done;
+    FILE *fp = fdopen(fd, "wb");
+    if (fp) {
+        ok = history_write(history, fp, format) && fsync(fd) == 0;
+        ok = fclose(fp) == 0 && ok;
+    } else {
+        close(fd);
+    }
+    ok = pl_readline_replace_commit(path, dest, ok);
+done:
+    if (lock >= 0) close(lock); // 同时释放锁
+    free(path);
+    free(target);
+    return ok;
+}
+#    else
+static bool history_save_file(pl_readline_history_t history, const char *filename, int format) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return false;
+    bool ok = history_write(history, fp, format);
+    return fclose(fp) == 0 && ok;
+}
+#    endif
+
+#    if PL_ENABLE_POSIX
+// 还指向旧映射的字符串复制到字符串池里，好换上新的映射
+static bool history_materialize(pl_readline_history_t history) {
+    for (uint32_t id = 1; id < history->atoms_len && history->map_refs; id++) {
+        pl_readline_history_atom *atom = &history->atoms[id];
+        if (!atom->refs || !atom->mapped) continue;
+        if (!pool_store(history, history->map + atom->offset, atom->len, &atom->offset)) return false;
+        atom->mapped = false;
+        history->map_refs--;
+    }
+    history_unmap(history);
+    return true;
+}
+
+// 一次把环形数组扩容到能再放下n项
+static void history_reserve(pl_readline_history_t history, usize n) {
+    usize cap = history->count + n < history->max ? history->count + n : history->max;
+    if (cap > history->cap) history_resize(history, cap); // 失败了就在history_push里慢慢扩
+}
+
+static void map_ref(pl_readline_history_t history, uint32_t *id, usize offset, usize len) {
+    if (!atom_intern(history, history->map + offset, len, offset, id)) *id = 0;
+}
+
+// 文本格式：从末尾往前找最多limit个非空行
+static usize map_text(pl_readline_history_t history, usize limit) {
+    const char              *map   = history->map;
+    usize                    size  = history->map_len;
+    usize                    found = 0, cap = 0;
+    struct {
+        usize offset, len;
+    }    *lines = NULL; // 从新到旧
+    usize                    end   = map[size - 1] == '\n' ? size - 1 : size; // 当前行的结尾
+    while (found < limit) {
+        const char *p     = end ? memrchr(map, '\n', end) : NULL;
+        usize       start = p ? (usize)(p - map) + 1 : 0;
+        if (end > start && end - start <= UINT32_MAX) {
+            if (found == cap) {
+                cap                        = cap ? cap * 2 : 1024;
+                void *n = realloc(lines, cap * sizeof(*lines));
+                if (!n) break;
+                lines = n;
+            }
+            lines[found].offset  = start;
+            lines[found++].len   = end - start;
+        }
+        if (!p) break;
+        end = p - map;
+    }
+
+    // 按从旧到新的顺序加进来，只有最新的max行能留下
+    usize keep = found < history->max ? found : history->max;
+    history_reserve(history, keep);
+    for (usize i = keep; i-- > 0;) {
+        pl_readline_history_entry *entry = history_push(history);
+        if (!entry) break;
+        map_ref(history, &entry->line, lines[i].offset, lines[i].len);
+        history_commit(history);
+    }
+    free(lines);
+    return found;
+}
+
+// 二进制格式：只读文件尾和最后keep条记录的偏移
+static usize map_binary(pl_readline_history_t history, usize limit) {
+    const char *map = history->map;
+    usize       size = history->map_len;
+    bin_tail    tail;
+    if (!bin_tail_read(map, size, &tail)) return 0;
+    usize found = tail.count < limit ? tail.count : limit;
+    usize keep  = found < history->max ? found : history->max;
+    history_reserve(history, keep);
+    for (usize i = tail.count - keep; i < tail.count; i++) {
+        bin_record rec;
+        usize      off;
+        if (!bin_record_read(map, size, &tail, i, &rec, &off) || !rec.len) continue;
+        pl_readline_history_entry *entry = history_push(history);
+        if (!entry) break;
+        map_ref(history, &entry->line, off, rec.len);
+        map_ref(history, &entry->cwd, off + rec.len, rec.cwd_len);
+        entry->time   = rec.time;
+        entry->status = rec.status;
+        history_commit(history);
+    }
+    if (tail.bloom_bits >= 8 && !(tail.bloom_bits & (tail.bloom_bits - 1)) &&
+        tail.bloom_offset <= size && tail.bloom_bits / 8 <= size - tail.bloom_offset) {
+        history->bloom        = map + tail.bloom_offset;
+        history->bloom_bits   = tail.bloom_bits;
+        history->bloom_hashes = tail.bloom_hashes;
+    }
+    return found;
+}
+
+// 映射fd指向的文件，文本格式从末尾往前找最多limit个非空行（为0时是能保存的记录数），
+// 二进制格式直接按索引取最后的记录，把其中最新的那些放进历史记录，返回找到的记录数（最多limit）
+usize pl_readline_history_map(pl_readline_history_t history, int fd, usize limit) {
+    struct stat st;
+    if (!limit) limit = history->max;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0 || !limit) return 0;
+    if (history->map && !history_materialize(history)) return 0;
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return 0;
+    history->map     = map;
+    history->map_len = st.st_size;
+    usize found = is_binary(map, st.st_size) ? map_binary(history, limit) : map_text(history, limit);
+    history_dedup(history);
+    if (!history->map_refs) history_unmap(history);
+    return found;
+}
+
+static void history_load_file(pl_readline_history_t history, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return;
+    pl_readline_history_map(history, fd, 0);
+    close(fd);
+}
+#    else
+static void history_load_file(pl_readline_history_t history, const char *filename) {
+    FILE *fp = fopen(filename, "rb");
     if (!fp) return;
-    // Read each line and prepend to history (so oldest ends up at tail)
     fseek(fp, 0, SEEK_END);
     long file_size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
     char *buffer = malloc(file_size + 1);
-    int n = fread(buffer, 1, file_size, fp);
-    if(n != file_size) {
+    if (!buffer || fread(buffer, 1, file_size, fp) != (usize)file_size) {
         free(buffer);
         fclose(fp);
         return; // Read error
     }
     buffer[file_size] = '\0';
-    // 按行分割
-    char *line = strtok(buffer, "\n");
-    while (line) {
-        self->history_idx = 0;
-        list_t node       = list_nth(self->history, self->history_idx);
-        free(node->data);
-        node->data = strdup(line);
-        line       = strtok(NULL, "\n");
-        pl_readline_add_history(self, "");
+    int dups          = history->dups; // 加载完再一次性去重
+    history->dups     = PL_READLINE_HISTORY_DUPS_KEEP;
+    bin_tail tail;
+    if (is_binary(buffer, file_size)) {
+        if (bin_tail_read(buffer, file_size, &tail)) {
+            usize keep = tail.count < history->max ? tail.count : history->max;
+            for (usize i = tail.count - keep; i < tail.count; i++) {
+                bin_record rec;
+                usize      off;
+                bool       added;
+                if (!bin_record_read(buffer, file_size, &tail, i, &rec, &off) || !rec.len ||
+                    !pl_readline_history_add(history, buffer + off, rec.len, &added) || !added)
+                    continue;
+                pl_readline_history_meta meta = {rec.time, rec.status, buffer + off + rec.len,
+                                                 rec.cwd_len};
+                pl_readline_history_set_meta(history, history->count - 1, &meta);
+            }
+        }
+    } else {
+        // 按行分割，文件里最旧的在前面
+        char *line = strtok(buffer, "\n");
+        while (line) {
+            pl_readline_history_add(history, line, strlen(line), NULL);
+            line = strtok(NULL, "\n");
+        }
     }
+    history->dups = dups;
+    history_dedup(history);
     free(buffer);
     fclose(fp);
 }
-#endif
\ No newline at end of file
+#    endif
+
+// 按原来的格式保存，文件不存在时用文本格式
+void pl_readline_save_history(_self, const char *filename) {
+    history_save_file(self->history, filename, file_format(filename));
+}
+
+int pl_readline_save_history_as(_self, const char *filename, int format) {
+    return history_save_file(self->history, filename, format) ? PL_READLINE_SUCCESS
+                                                              : PL_READLINE_FAILED;
+}
+
+// 根据文件头自动识别格式
+void pl_readline_load_history(_self, const char *filename) {
+    history_load_file(self->history, filename);
+}
+
+// 把历史记录文件转换成另一种格式
+int pl_readline_history_convert(const char *from, const char *to, int format) {
+    pl_readline_history_t history = pl_readline_history_new(SIZE_MAX);
+    if (!history) return PL_READLINE_FAILED;
+    history_load_file(history, from);
+    bool ok = history_save_file(history, to, format);
+    pl_readline_history_free(history);
+    return ok ? PL_READLINE_SUCCESS : PL_READLINE_FAILED;
+}
+#endif
@@ -0,0 +1,165 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_input.c : 终端输入的解码
+//
+// 设置了 pl_readline_hal_read 时，一次读入一批原始字节，由状态机逐字节解码成按键。
+// 解码器的状态保存在实例上，一个转义序列被拆到两次读取里也能接上，
+// 一次读取中的多个按键则留在缓冲区里，之后不用再调用 pl_readline_hal_read。
+// pl_readline_feed 送进来的字节直接解码，一行结束之后剩下的字节也放进这个缓冲区，留给下一行。
+
+#include "pl_readline.h"
+#include <string.h>
+
+enum {
+    DECODE_GROUND, // 普通字符
+    DECODE_ESC,    // 读到了ESC
+    DECODE_CSI,    // ESC [ 之后，读参数直到结束字节
+    DECODE_SS3,    // ESC O 之后的一个字节
+};
+
+#define ANY -1
+
+// CSI/SS3序列到按键的映射，按顺序取第一个匹配的
+typedef struct {
+    char    final; // 结束字节
+    int16_t param; // 第一个参数，ANY表示不限
+    int8_t  mod;   // 修饰键参数（5为Ctrl，3为Alt），ANY表示不限
+    int     key;
+} csi_key;
+
+static const csi_key csi_keys[] = {
+    {'C', ANY, 5,   PL_READLINE_KEY_WORD_RIGHT },
+    {'D', ANY, 5,   PL_READLINE_KEY_WORD_LEFT  },
+    {'C', ANY, 3,   PL_READLINE_KEY_WORD_RIGHT },
+    {'D', ANY, 3,   PL_READLINE_KEY_WORD_LEFT  },
+    {'A', ANY, ANY, PL_READLINE_KEY_UP         },
+    {'B', ANY, ANY, PL_READLINE_KEY_DOWN       },
+    {'C', ANY, ANY, PL_READLINE_KEY_RIGHT      },
+    {'D', ANY, ANY, PL_READLINE_KEY_LEFT       },
+    {'H', ANY, ANY, PL_READLINE_KEY_HOME       },
+    {'F', ANY, ANY, PL_READLINE_KEY_END        },
+    {'~', 1,   ANY, PL_READLINE_KEY_HOME       },
+    {'~', 7,   ANY, PL_READLINE_KEY_HOME       },
+    {'~', 4,   ANY, PL_READLINE_KEY_END        },
+    {'~', 8,   ANY, PL_READLINE_KEY_END        },
+    {'~', 5,   ANY, PL_READLINE_KEY_PAGE_UP    },
+    {'~', 6,   ANY, PL_READLINE_KEY_PAGE_DOWN  },
+    {'~', 200, ANY, PL_READLINE_KEY_PASTE_START},
+    {'~', 201, ANY, PL_READLINE_KEY_PASTE_END  },
+};
+
+static int csi_lookup(char final, int param, int mod) {
+    for (usize i = 0; i < sizeof(csi_keys) / sizeof(csi_keys[0]); i++) {
+        const csi_key *k = &csi_keys[i];
+        if (k->final == final && (k->param == ANY || k->param == param) &&
+            (k->mod == ANY || k->mod == mod))
+            return k->key;
+    }
+    return -1; // 不认识的序列整个丢掉
+}
+
+// 不属于转义序列的字节
+static int plain_key(int byte) {
+    switch (byte) {
+    case '\r': return PL_READLINE_KEY_ENTER;
+    case 0x7f: return PL_READLINE_KEY_BACKSPACE;
+    default: return byte;
+    }
+}
+
+// 解码一个字节，得到一个按键时返回它，序列还没结束时返回-1
+int pl_readline_decode(pl_readline_decoder *dec, int byte) {
+    switch (dec->state) {
+    case DECODE_ESC:
+        dec->state = DECODE_GROUND;
+        if (byte == '[' || byte == 'O') {
+            dec->state    = byte == '[' ? DECODE_CSI : DECODE_SS3;
+            dec->nparam   = 0;
+            dec->param[0] = 0;
+            dec->param[1] = 0;
+            return -1;
+        }
+        if (byte == 'b') return PL_READLINE_KEY_WORD_LEFT;  // Alt+b
+        if (byte == 'f') return PL_READLINE_KEY_WORD_RIGHT; // Alt+f
+        if (byte == 0x1b) {
+            dec->state = DECODE_ESC;
+            return -1;
+        }
+        return plain_key(byte); // 其它的Alt组合键当作普通字符
+    case DECODE_CSI:
+        if (byte >= '0' && byte <= '9') {
+            int *p = &dec->param[dec->nparam];
+            if (*p < 10000) *p = *p * 10 + byte - '0';
+            return -1;
+        }
+        if (byte == ';') {
+            if (dec->nparam < 1) dec->nparam++; // 只关心前两个参数
+            return -1;
+        }
+        if (byte >= 0x20 && byte < 0x40) return -1; // 其它参数和中间字节
+        dec->state = DECODE_GROUND;
+        if (byte < 0x20) return plain_key(byte);    // 序列被控制字符打断了
+        return csi_lookup(byte, dec->param[0], dec->param[1]);
+    case DECODE_SS3:
+        dec->state = DECODE_GROUND;
+        return csi_lookup(byte, 0, 0);
+    default:
+        if (byte == 0x1b) {
+            dec->state = DECODE_ESC;
+            return -1;
+        }
+        return plain_key(byte);
+    }
+}
+
+// 保证输入缓冲区在已有内容之后还能放下extra字节，已经解码过的部分顺便丢掉
+static bool input_reserve(_self, usize extra) {
+    if (self->in_pos) {
+        memmove(self->in_buf, self->in_buf + self->in_pos, self->in_len - self->in_pos);
+        self->in_len -= self->in_pos;
+        self->in_pos  = 0;
+    }
+    if (self->in_len + extra <= self->in_cap) return true;
+    usize cap = self->in_cap ? self->in_cap : PL_READLINE_READ_SIZE;
+    while (cap < self->in_len + extra) {
+        cap *= 2;
+    }
+    char *buf = realloc(self->in_buf, cap);
+    if (!buf) return false;
+    self->in_buf = buf;
+    self->in_cap = cap;
+    return true;
+}
+
+// 把还没解码的字节放进输入缓冲区
+bool pl_readline_input_append(_self, const char *bytes, usize len) {
+    if (!len) return true;
+    if (!input_reserve(self, len)) return false;
+    memcpy(self->in_buf + self->in_len, bytes, len);
+    self->in_len += len;
+    return true;
+}
+
+// 读取下一个按键：没有设置 pl_readline_hal_read 时直接调用 pl_readline_hal_getch
+int pl_readline_read_key(_self) {
+    for (;;) {
+        while (self->in_pos < self->in_len) {
+            int key = pl_readline_decode(&self->decoder, (unsigned char)self->in_buf[self->in_pos++]);
+            if (key >= 0) return key;
+        }
+        if (!self->pl_readline_hal_read) return self->pl_readline_hal_getch();
+        self->in_pos = self->in_len = 0;
+        if (!input_reserve(self, PL_READLINE_READ_SIZE)) return -1;
+        int n = self->pl_readline_hal_read(self->in_buf, PL_READLINE_READ_SIZE);
+        if (n <= 0) return -1;
+        self->in_len = n;
+    }
+}
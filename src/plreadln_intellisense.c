@@ -14,171 +14,209 @@
 #include <stdio.h>
 #include <string.h>
 
-// 向输入缓冲区插入字符
-static void insert_char(_self, char ch) {
-    pl_readline_insert_char_and_view(self, ch);
-    pl_readline_insert_char(self->input_buf, ch, self->input_ptr++);
-}
-
-// 向输入缓冲区插入字符串
-static void insert_string(_self, char *str) {
-    while (*str) {
-        insert_char(self, *str++);
-    }
-}
-
-// 找到相同前缀的单词
+// 把word并入公共前缀prefix（prefix为NULL时就是word本身）
 // 使用此函数需要记得free返回的指针
-static char *get_same_prefix(pl_readline_words_t words) {
-    char  *prefix = NULL;
-    isize len    = 0;
-    for (isize i = 0; i < words->len; i++) {
-        if (prefix == NULL) {
-            prefix = strdup(words->words[i].word);
-            len    = strlen(prefix);
-        } else {
-            isize j = 0;
-            while (j < len && (unsigned long)j < strlen(words->words[i].word) &&
-                   prefix[j] == words->words[i].word[j]) {
-                j++;
-            }
-            if (j < len) {
-                prefix    = realloc(prefix, j + 1);
-                len       = j;
-                prefix[j] = '\0';
-            }
-        }
+static char *merge_prefix(char *prefix, const char *word) {
+    if (!prefix) return strdup(word);
+    isize j = 0;
+    while (prefix[j] && prefix[j] == word[j]) {
+        j++;
     }
+    prefix[j] = '\0';
     return prefix;
 }
 
-// 检查是否是第一个单词
-static bool check_is_first(_self) {
-    int p = self->ptr;
-    while (p) {
-        if (self->buffer[--p] == ' ') { // 看一下前面有没有空格
-            return false;               // 不是第一个单词
-        }
+// 列出一个候选词
+static void print_candidate(_self, const pl_readline_word *word, int *times) {
+    if (*times == 0) {               // 第一次输出
+        pl_readline_next_line(self); // 换行
+    } else {
+        pl_readline_print(self, " "); // 空格分隔
+    }
+    if (word->color != PL_COLOR_RESET) {
+        char color_str[16];
+        sprintf(color_str, "\033[%dm", word->color);
+        pl_readline_print(self, color_str); // 设置颜色
+    }
+    pl_readline_print(self, word->word); // 输出单词
+    if (word->color != PL_COLOR_RESET) {
+        pl_readline_print(self, "\033[0m"); // 重置颜色
     }
-    return true;
+    (*times)++; // 输出次数加一
+}
+
+// 回调给出的词是否可以作为buf的补全
+static bool candidate_matches(const pl_readline_word *word, const char *buf, isize idx,
+                              bool is_first) {
+    return strncmp(buf, word->word, idx) == 0 && (is_first || !word->first);
 }
 
 // 自动补全
-pl_readline_word pl_readline_intellisense(_self, pl_readline_words_t words) {
-    char  *buf;                             // 用户输入的缓冲区
-    int    times = 0;                       // 输出补全词库的次数
-    isize idx;                             // self->intellisense_word的索引
-    int    flag     = 0;                    // 用户输入的词存不存在
-    bool   is_first = check_is_first(self); // 是否是第一个单词
+// 候选词来自两处：pl_readline_dict_add注册的常驻词库（基数树）和pl_readline_get_words回调
+// fetch时words 在这里会被清空后交给回调（打开了缩小时可能改用缓存的候选词），由调用者持有，可以反复使用；
+// 否则words已经填好了
+static pl_readline_word intellisense(_self, pl_readline_words_t words, bool fetch) {
+    pl_readline_word ret      = {0};
+    isize            start    = pl_readline_word_start(self);
+    isize            plen     = self->ptr - start;                       // 光标前单词的长度
+    bool             is_first = pl_readline_token_is_first(self, start); // 是否是第一个单词
+    char            *cur      = malloc(plen + 1);                        // 光标前的单词
+    char            *buf;                                                // 补全的前缀
+    isize            idx;                                                // 前缀的长度
+    if (!cur) return ret;
+    pl_readline_dict_t dict = pl_readline_dict_current(self); // 常驻词库
+    pl_readline_buffer_copy(self, start, self->ptr, cur);
+    cur[plen] = '\0';
     if (self->intellisense_mode == false) { // 如果是这个模式，则我们需要插入些东西
-        buf = strdup(self->input_buf);      // 保存一下
         // self->intellisense_word将会在后面被释放，不用担心内存泄漏
-        self->intellisense_word = buf;
-        buf[self->input_ptr]    = '\0';            // 加上结束符
-        idx                     = self->input_ptr; // 索引
-    } else {                                       // 列出模式
-        buf = self->intellisense_word;             // 重定向buf
-        idx = strlen(buf);                         // 设置索引
+        free(self->intellisense_word); // 上一次tab没有进入列出模式时留下的
+        self->intellisense_word = buf = cur;
+        idx                           = plen;
+    } else { // 列出模式，沿用第一次按tab时的前缀
+        buf = self->intellisense_word;
+        idx = strlen(buf);
     }
-    self->pl_readline_get_words(buf, words); // 请求词库
-    int  can_be_selected = 0;                // 可能的单词数
-    char sep             = 0;                // 用于分隔符
+    if (fetch) words = pl_readline_fetch_words(self, buf, words); // 请求词库
+
+    int              can_be_selected = 0; // 可能的单词数
+    int              flag            = 0; // 用户输入的词存不存在
+    char             sep             = 0; // 用于分隔符
+    pl_readline_word info;
+    if (pl_readline_dict_lookup(dict, cur, plen, &info) && (is_first || !info.first)) {
+        flag = 1;
+        sep  = info.sep;
+    }
+    can_be_selected += pl_readline_dict_count(dict, cur, plen, is_first) - flag;
     for (isize i = 0; i < words->len; i++) {
-        if (strncmp(buf, words->words[i].word, idx) == 0 &&
-            (is_first || !words->words[i].first)) {                     // 找到相同前缀的单词
-            if (strlen(words->words[i].word) > (unsigned long)self->input_ptr)         // 找到的单词比输入的长
-                can_be_selected++;                                      // 可能的单词数加一
-            if (strlen(words->words[i].word) == (unsigned long)self->input_ptr) {      // 找到的单词和输入的一样长
-                char *temp_buffer            = strdup(self->input_buf); // 临时缓冲区
-                temp_buffer[self->input_ptr] = '\0';                    // 加上结束符
-                if (strcmp(words->words[i].word, temp_buffer) == 0) {   // 找到的单词和输入一样
-                    flag = 1;                                           // flag代表有这个词
-                    sep  = words->words[i].sep;                         // 用于分隔符
-                } else {
-                    can_be_selected++; // 可能的单词数加一
-                }
-                free(temp_buffer); // 释放临时缓冲区
+        if (!candidate_matches(&words->words[i], buf, idx, is_first)) continue;
+        isize len = strlen(words->words[i].word);
+        if (len > plen) {                                       // 找到的单词比输入的长
+            can_be_selected++;                                  // 可能的单词数加一
+        } else if (len == plen) {                               // 找到的单词和输入的一样长
+            if (strcmp(words->words[i].word, cur) == 0) {       // 找到的单词和输入一样
+                flag = 1;                                       // flag代表有这个词
+                sep  = words->words[i].sep;                     // 用于分隔符
+            } else {
+                can_be_selected++; // 可能的单词数加一
             }
         }
     }
     // 该单词在词库中只有一个可匹配项，那么不需要补全
     if (can_be_selected == 0 && flag == 1) {
-        pl_readline_word_maker_destroy(words); // 释放words
-        if (sep)                               // 有分隔符，插入一下即可
+        if (sep) // 有分隔符，插入一下即可
             pl_readline_handle_key(self, sep);
-        return (pl_readline_word){0};
+        goto done;
     }
 
-    pl_readline_words_t words_temp = NULL;
     if (!self->intellisense_mode) {
-        words_temp = pl_readline_word_maker_init(); // 临时词库，用于存储“可能”的单词
-        if (idx == 0) {                             // 没东西我们直接输出词库
-            goto NOTHING_INPUT;
-        }
-    }
-    for (isize i = 0; i < words->len; i++) {
-        if (strncmp(buf, words->words[i].word, idx) == 0 && (is_first || !words->words[i].first)) {
-            // 和用户输入一样的单词有什么好必要补全的？
-            if (!self->intellisense_mode && strlen(words->words[i].word) == (unsigned long)idx) {
-                // 直接下一个
-                continue;
-            }
-            if (!self->intellisense_mode) { // 如果是需要输出模式
-                pl_readline_word_maker_add(words->words[i].word, words_temp, false,
-                                           words->words[i].color,
-                                           0); // 加入临时词库
-            } else {
-                if (times == 0) {                // 第一次输出
-                    pl_readline_next_line(self); // 换行
-                }
-                if (times)                        // 不是第一次输出
-                    pl_readline_print(self, " "); // 空格分隔
-                if (words->words[i].color != PL_COLOR_RESET) {
-                    char color_str[16];
-                    sprintf(color_str, "\033[%dm", words->words[i].color);
-                    pl_readline_print(self, color_str); // 设置颜色
-                }
-                pl_readline_print(self, words->words[i].word); // 输出单词
-                if (words->words[i].color != PL_COLOR_RESET) {
-                    pl_readline_print(self, "\033[0m"); // 重置颜色
+        self->intellisense_mode = true;
+        if (idx != 0) { // 没东西我们直接输出词库
+            // 公共前缀：基数树直接给出自己那部分，再并上回调给出的词
+            // 和用户输入一样的单词有什么好必要补全的？所以不算在内
+            char *prefix = pl_readline_dict_common_prefix(dict, buf, idx, is_first);
+            for (isize i = 0; i < words->len; i++) {
+                if (candidate_matches(&words->words[i], buf, idx, is_first) &&
+                    strlen(words->words[i].word) != (size_t)idx) {
+                    prefix = merge_prefix(prefix, words->words[i].word);
                 }
-                times++; // 输出次数加一
             }
+            // 若prefix为NULL，则不会去插入，这是调用者决定的，我这里不管
+            if (!prefix || strcmp(prefix, buf) != 0) {
+                ret.word = prefix;
+                goto done;
+            }
+            /*
+               找到的相同前缀和输入的一样
+               那么就是什么都没有改变，因而直接输出补全列表
+            */
+            free(prefix);
         }
     }
-    pl_readline_word ret = {0};
-    if (self->intellisense_mode == false) {
-        // 找到相同前缀的单词
-        // 作者按：这里 get_same_prefix 不可能找不到相同前缀的单词，
-        // 因为 words_temp
-        // 里只有可能的单词，那么，天然的，他们已经有相同的前缀，只是多与少而已。
-        // 但 prefix 仍然有可能为NULL,即：words_temp 里没有单词。
-        char *prefix = get_same_prefix(words_temp);
-        /*
-           找到的相同前缀和输入的一样
-           那么就是什么都没有改变，因而直接输出补全列表
-        */
-        if (prefix && strcmp(prefix, buf) == 0) {
-            free(prefix);
-        NOTHING_INPUT:
-            self->intellisense_mode = true;             // 设置为列出模式
-            pl_readline_word_maker_destroy(words_temp); // 释放words_temp
-            pl_readline_word_maker_destroy(words);      // 释放words
-            words = pl_readline_word_maker_init();      // 重新初始化words
 
-            return pl_readline_intellisense(self, words);
+    // 列出所有候选词，基数树里的按字典序在前，回调给出的重复词跳过
+    int                 times = 0; // 输出补全词库的次数
+    pl_readline_words_t found = pl_readline_word_maker_get(&self->words_temp);
+    if (found) {
+        pl_readline_word_maker_clear(found);
+        pl_readline_dict_collect(dict, buf, idx, is_first, found);
+    }
+    for (isize i = 0; found && i < found->len; i++) {
+        print_candidate(self, &found->words[i], &times);
+    }
+    for (isize i = 0; i < words->len; i++) {
+        const char *word = words->words[i].word;
+        if (!candidate_matches(&words->words[i], buf, idx, is_first) ||
+            pl_readline_dict_lookup(dict, word, strlen(word), &info))
+            continue;
+        print_candidate(self, &words->words[i], &times);
+    }
+    if (times) ret.first = true;
+
+done:
+    if (cur != buf) free(cur); // 否则cur已经交给了self->intellisense_word
+    return ret;
+}
+
+pl_readline_word pl_readline_intellisense(_self, pl_readline_words_t words) {
+    return intellisense(self, words, true);
+}
+
+// 异步请求给出的候选词已经在words里了
+pl_readline_word pl_readline_intellisense_ready(_self, pl_readline_words_t words) {
+    return intellisense(self, words, false);
+}
+
+// 补全的前缀：第一次按tab时是光标前的单词，列出模式下沿用第一次的前缀；需要free
+char *pl_readline_completion_word(_self) {
+    if (self->intellisense_mode) return strdup(self->intellisense_word);
+    isize start = pl_readline_word_start(self);
+    char *word  = malloc(self->ptr - start + 1);
+    if (!word) return NULL;
+    pl_readline_buffer_copy(self, start, self->ptr, word);
+    word[self->ptr - start] = '\0';
+    return word;
+}
+
+// 模糊补全：光标前的单词作为子序列去匹配，按得分从高到低列出；只有一个匹配时直接替换掉这个单词。
+// fetch为false时回调给出的词已经由异步请求放进了words
+pl_readline_word pl_readline_intellisense_fuzzy(_self, pl_readline_words_t words, bool fetch) {
+    pl_readline_word ret   = {0};
+    isize            start = pl_readline_word_start(self);
+    isize            plen  = self->ptr - start;
+    if (!plen) return intellisense(self, words, fetch); // 什么都没输入时列出所有的词
+    char *query = malloc(plen + 1);
+    if (!query) return ret;
+    pl_readline_buffer_copy(self, start, self->ptr, query);
+    query[plen] = '\0';
+    bool is_first = pl_readline_token_is_first(self, start);
+    if (fetch) words = pl_readline_fetch_words_uncached(self, query, words); // 缩小的缓存只按前缀
+
+    pl_readline_word top[PL_READLINE_FUZZY_TOP];
+    usize n = pl_readline_fuzzy_match(self, query, is_first, words, top, PL_READLINE_FUZZY_TOP);
+    if (n == 1) {
+        // 先复制一份：重绘时着色会重新请求词库，top里的词可能被覆盖
+        char *word = strdup(top[0].word);
+        char  sep  = top[0].sep;
+        if (word) {
+            pl_readline_buffer_delete(self, start, plen);
+            self->ptr = start;
+            pl_readline_insert_string(self, word, strlen(word));
+            if (sep) pl_readline_insert_string(self, &sep, 1);
+            free(word);
         }
-        // 若prefix为NULL，则不会去插入，这是调用者决定的，我这里不管
-        ret.word                = prefix;
-        self->intellisense_mode = true;
-        pl_readline_word_maker_destroy(words_temp);
+    } else {
+        int times = 0;
+        for (usize i = 0; i < n; i++) {
+            print_candidate(self, &top[i], &times);
+        }
+        if (times) ret.first = true;
     }
-    if (self->intellisense_mode && times) { ret.first = true; }
-    pl_readline_word_maker_destroy(words); // 释放words
+    free(query);
     return ret;
 }
 
 void pl_readline_intellisense_insert(_self, pl_readline_word word) {
-    insert_string(self, word.word + self->input_ptr);
+    char *rest = word.word + (self->ptr - pl_readline_word_start(self));
+    pl_readline_insert_string(self, rest, strlen(rest));
     free(word.word);
 }
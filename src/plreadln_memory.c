@@ -0,0 +1,143 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_memory.c : 内存占用
+//
+// 一个会话的缓冲区都是用到时才分配，并且只会变大。释放分两级：
+// 每一行开始时（pl_readline_trim_line）把容量超过 PL_READLINE_IDLE_KEEP 字节的缓冲区释放掉
+// （输入缓冲区缩回默认大小），没超过的和着色缓存留着给下一行用，避免每一行都重新分配；
+// 只在重绘时临时用的缓冲区则总是释放。
+// 会话在提示符处等待输入时，应用程序可以调用 pl_readline_trim 把能重建的都释放掉：
+// 着色缓存、各种索引、候选词、帧和输出缓冲区，只留下实例本身、输入行和历史记录。
+
+#include "pl_readline.h"
+
+// 容量超过 PL_READLINE_IDLE_KEEP 字节就释放，下次用到时再分配
+#define TRIM(ptr, cap, unit)                                                                       \
+    do {                                                                                           \
+        if ((usize)(cap) * (unit) > PL_READLINE_IDLE_KEEP) {                                       \
+            free(ptr);                                                                             \
+            (ptr) = NULL;                                                                          \
+            (cap) = 0;                                                                             \
+        }                                                                                          \
+    } while (0)
+
+// 释放上一行留下的大块内存，在输入行清空之后、开始新的一行之前调用
+void pl_readline_trim_line(_self) {
+    if (self->maxlen > PL_READLINE_IDLE_KEEP && !self->length) {
+        char *buffer = realloc(self->buffer, PL_READLINE_DEFAULT_BUFFER_LEN);
+        if (buffer) {
+            self->buffer = buffer;
+            self->maxlen = PL_READLINE_DEFAULT_BUFFER_LEN;
+            self->gap    = 0;
+        }
+    }
+    TRIM(self->history_line, self->history_line_cap, 1);
+    TRIM(self->annotation, self->annotation_cap, 1);
+    TRIM(self->tokens, self->token_cap, sizeof(pl_readline_token));
+    free(self->token_scratch); // 重绘时临时用的
+    self->token_scratch     = NULL;
+    self->token_scratch_cap = 0;
+    pl_readline_spans_trim(self);
+    if (!self->out_len) TRIM(self->out_buf, self->out_cap, 1);
+    if (self->in_pos == self->in_len) { // 没有留给这一行的输入
+        self->in_pos = self->in_len = 0;
+        TRIM(self->in_buf, self->in_cap, 1);
+    }
+    if ((usize)self->frame_cap * 2 * sizeof(pl_readline_cell) > PL_READLINE_IDLE_KEEP) {
+        free(self->frame);
+        self->frame     = NULL;
+        self->frame_cap = 0;
+        self->frame_len = 0;
+    }
+    pl_readline_color_cache_trim(self);
+    pl_readline_word_maker_trim(self->words, PL_READLINE_IDLE_KEEP);
+    pl_readline_word_maker_trim(self->words_temp, PL_READLINE_IDLE_KEEP);
+    pl_readline_candidates_trim(self);
+    pl_readline_search_trim(self);
+    pl_readline_prefix_trim(self);
+}
+
+// 会话空闲时释放所有能重建的内存，下次用到时再分配（索引要重新建立）。
+// 输入行不是空的、正在搜索、翻看历史记录或者等待补全时什么也不做
+void pl_readline_trim(_self) {
+    if (self->length || self->key_depth || self->paste || self->history_idx ||
+        self->intellisense_mode || self->pending || self->annotation_len ||
+        pl_readline_search_active(self))
+        return;
+    pl_readline_trim_line(self);
+    if (self->maxlen > PL_READLINE_DEFAULT_BUFFER_LEN) {
+        char *buffer = realloc(self->buffer, PL_READLINE_DEFAULT_BUFFER_LEN);
+        if (buffer) {
+            self->buffer = buffer;
+            self->maxlen = PL_READLINE_DEFAULT_BUFFER_LEN;
+            self->gap    = 0;
+        }
+    }
+    free(self->history_line);
+    free(self->annotation);
+    free(self->tokens);
+    self->history_line     = NULL;
+    self->history_line_cap = 0;
+    self->annotation       = NULL;
+    self->annotation_cap   = 0;
+    self->tokens           = NULL;
+    self->token_cap        = 0;
+    self->token_count      = 0;
+    pl_readline_spans_free(self);
+    if (!self->out_len) {
+        free(self->out_buf);
+        self->out_buf = NULL;
+        self->out_cap = 0;
+    }
+    if (self->in_pos == self->in_len) {
+        free(self->in_buf);
+        self->in_buf = NULL;
+        self->in_cap = 0;
+    }
+    if (!self->frame_len) { // 终端上已经没有上一帧了
+        free(self->frame);
+        self->frame     = NULL;
+        self->frame_cap = 0;
+    }
+    pl_readline_color_cache_free(self);
+    if (self->words) pl_readline_word_maker_destroy(self->words);
+    if (self->words_temp) pl_readline_word_maker_destroy(self->words_temp);
+    self->words      = NULL;
+    self->words_temp = NULL;
+    pl_readline_candidates_free(self);
+    pl_readline_fuzzy_free(self);
+    pl_readline_search_free(self);
+    pl_readline_prefix_free(self);
+}
+
+// 这个会话占用的内存（字节）；共用的历史记录按共用的实例数平摊
+usize pl_readline_memory_usage(_self) {
+    usize size = sizeof(struct pl_readline) + self->maxlen + self->history_line_cap +
+                 self->annotation_cap + self->out_cap + self->in_cap;
+    size += (self->frame_cap * 2) * sizeof(pl_readline_cell);
+    size += (self->token_cap + self->token_scratch_cap) * sizeof(pl_readline_token);
+    if (self->stats) size += sizeof(pl_readline_stats);
+    size += pl_readline_paste_memory(self);
+    size += pl_readline_spans_memory(self);
+    size += pl_readline_word_maker_memory(self->words);
+    size += pl_readline_word_maker_memory(self->words_temp);
+    size += pl_readline_candidates_memory(self);
+    size += pl_readline_fuzzy_memory(self);
+    size += pl_readline_color_cache_memory(self);
+    size += pl_readline_dict_memory(self->dict);
+    size += pl_readline_search_memory(self);
+    size += pl_readline_prefix_memory(self);
+    size += pl_readline_history_memory(self->history) / pl_readline_history_refs(self->history);
+#if PL_ENABLE_HISTORY_FILE && PL_ENABLE_POSIX
+    size += pl_readline_history_file_memory(self);
+#endif
+    return size;
+}
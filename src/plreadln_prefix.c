@@ -0,0 +1,1018 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_prefix.c : 按前缀翻看历史记录（上下方向键）
+//
+// 所有历史记录的序号按 (内容, 序号) 排好序，以某个前缀开头的记录在其中是连续的一段，
+// 两次二分查找就能找到。相同内容的记录也挨在一起，每组只取最新的一条（序号最大）。
+// 翻看时用一个按区间最大序号的大根堆：开始时只放进整个那一段，每按一次上方向键弹出一个区间，
+// 用线段树找出其中最新的一条，跳过和它内容相同的那一组，再把左右两边的区间放回去，
+// 每一步 O(log n)，和那一段有多长无关。
+//
+// 光标在行尾时，以输入行开头的最新一条记录剩下的部分会以灰色显示在后面（自动建议），
+// 按右方向键或 End 接受。最新的一条就是上面那一段里序号最大的，用线段树 O(log n) 求出；
+// 输入行变长时只在上一次的那一段里继续二分。
+//
+// 新提交的记录先放进一小段单独排序的 run（最多 PL_READLINE_SUGGEST_RUN 条），查找时两边都查，
+// run满了才合并进主体，线段树只更新变了的那些叶子。一次加载进来的大量记录在 bulk 里
+// 一小段一小段地排序、两两归并，排好之后再合并进主体。每次按键做这些整理最多花
+// PL_READLINE_SUGGEST_BUDGET 微秒，剩下的留到下一次；翻看要用完整的索引，开始翻看时一次做完。
+// 索引里同时记下每条记录内容的字符串编号，比较时不用再按序号查找记录。
+//
+// 历史记录淘汰或删掉的记录，内容会在 pl_readline_history_removed_at 里留一阵子，按内容二分找到它删掉。
+// 主体里的不挪动后面的记录，原地换成相邻记录的副本并标记删除（排序不变，线段树里是空的），
+// 标记的多了再整理时一次清掉。bulk 里的不打断正在做的归并，先留着内容，合并进主体之后再删。
+// 跟不上（一次删掉了很多条）时才逐个检查索引里的记录。
+
+#include "pl_readline.h"
+#include <string.h>
+#if PL_ENABLE_POSIX
+#    include <time.h>
+#endif
+
+// 索引里的一条记录
+typedef struct prefix_key {
+    uint32_t seq;  // 记录序号，主体里标记删除的带有 KEY_DEAD
+    uint32_t line; // 内容的字符串编号，内容相同的记录编号相同
+} prefix_key;
+
+#define KEY_DEAD 0x80000000u // 序号的最高位借来当删除标记
+
+// 按 (内容, 序号) 排好序的一串记录
+typedef struct prefix_keys {
+    prefix_key *keys;
+    usize       len;
+    usize       cap;
+} prefix_keys;
+
+// sorted[lo, hi) 中还没有翻到的记录，其中最大的序号是seq
+typedef struct nav_range {
+    uint32_t seq;
+    usize    lo;
+    usize    hi;
+} nav_range;
+
+struct pl_readline_prefix {
+    // 索引
+    prefix_keys sorted;        // 主体
+    prefix_keys run;           // 还没有合并进主体的新记录
+    prefix_keys bulk;          // 正在排序的大量记录，排好之前不参与查找
+    uint32_t   *bulk_ends;     // bulk 分成的各段（每段排好了序）的结尾
+    usize       bulk_ends_len;
+    usize       bulk_ends_cap;
+    prefix_keys bulk_gone;     // bulk 里已经删掉的记录，内容留着（line_hold），合并进主体之后再删
+    prefix_key *merge_tmp;     // 正在归并 bulk 的最后两段时，最后一段的副本
+    usize       merge_len;
+    usize       merge_i;       // 前一段还没有归并的部分到 merge_i 为止
+    usize       merge_j;       // merge_tmp 还没有归并的部分是 [0, merge_j)
+    uint64_t    indexed;       // 这个序号之后（含）的记录还没有放进索引
+    uint64_t    removed;       // 历史记录删掉的记录处理到了第几条（pl_readline_history_removed）
+    usize       dead;          // sorted 里标记删除的记录数
+    uint32_t   *pending;       // 放进索引之后又被修改过的记录，按新的内容重新放进去
+    usize       pending_len;
+    usize       pending_cap;
+    uint32_t    version;       // sorted 每变一次加一
+    uint32_t   *tree;          // sorted 上求区间最大序号（加一，0为空）的线段树
+    usize       tree_size;     // 叶子数（2的幂），tree[tree_size + i] 对应 sorted[i]
+
+    // 自动建议
+    char     *query;   // 上一次查找建议时的输入行
+    usize     query_len;
+    usize     query_cap;
+    usize     query_lo; // 以query开头的记录在sorted中的范围
+    usize     query_hi;
+    uint32_t  query_version;
+    bool      shown;    // annotation 里现在是建议
+    bool      hidden;   // 暂时不显示建议（提交输入行、列出补全之前）
+
+    // 正在翻看的状态
+    nav_range *heap;        // 还没有翻到的区间，按区间里最大的序号的大根堆
+    usize      heap_len;
+    usize      heap_cap;
+    uint32_t  *visited;     // 已经翻过的记录，visited[i] 是往前第 i+1 条
+    usize      visited_len;
+    usize      visited_cap;
+    usize      pos;         // 当前显示 visited[pos-1]，0为输入行
+    int        nav_idx;     // 翻看时设置的 history_idx，对不上说明被别的按键改过了
+    uint32_t   nav_version; // 建立heap时的 version，索引变了要重新建立
+    bool       nav_active;
+};
+
+static bool seqs_reserve(uint32_t **seqs, usize *cap, usize len) {
+    if (len <= *cap) return true;
+    usize new_cap = *cap ? *cap : 16;
+    while (new_cap < len) {
+        new_cap *= 2;
+    }
+    uint32_t *p = realloc(*seqs, new_cap * sizeof(uint32_t));
+    if (!p) return false;
+    *seqs = p;
+    *cap  = new_cap;
+    return true;
+}
+
+static bool keys_reserve(prefix_keys *keys, usize len) {
+    if (len <= keys->cap) return true;
+    usize cap = keys->cap ? keys->cap : 16;
+    while (cap < len) {
+        cap *= 2;
+    }
+    prefix_key *p = realloc(keys->keys, cap * sizeof(prefix_key));
+    if (!p) return false;
+    keys->keys = p;
+    keys->cap  = cap;
+    return true;
+}
+
+static void keys_free(prefix_keys *keys) {
+    free(keys->keys);
+    keys->keys = NULL;
+    keys->len  = 0;
+    keys->cap  = 0;
+}
+
+// 第idx条记录
+static prefix_key key_at(_self, usize idx) {
+    return (prefix_key){
+        .seq  = pl_readline_history_seq(self->history, idx),
+        .line = pl_readline_history_line_id(self->history, idx),
+    };
+}
+
+static const char *key_line(_self, prefix_key key, usize *len) {
+    return pl_readline_history_line(self->history, key.line, len);
+}
+
+// 序号为seq的记录的内容
+static const char *entry_line(_self, uint32_t seq, usize *len) {
+    usize idx;
+    pl_readline_history_find(self->history, seq, &idx); // 索引里的记录都还在
+    return pl_readline_history_get(self->history, idx, len);
+}
+
+// 比较两条记录的内容，内容相同时按序号
+static int key_cmp(_self, prefix_key a, prefix_key b) {
+    if (a.line != b.line) {
+        usize       alen, blen;
+        const char *x = key_line(self, a, &alen);
+        const char *y = key_line(self, b, &blen);
+        int         r = memcmp(x, y, alen < blen ? alen : blen);
+        if (r) return r;
+        if (alen != blen) return alen < blen ? -1 : 1;
+    }
+    uint32_t x = a.seq & ~KEY_DEAD, y = b.seq & ~KEY_DEAD;
+    return x < y ? -1 : x > y;
+}
+
+// 记录的内容和前缀比较，以前缀开头时返回0
+static int prefix_cmp(_self, prefix_key key, const char *prefix, usize len) {
+    usize       n;
+    const char *line = key_line(self, key, &n);
+    int         r    = memcmp(line, prefix, n < len ? n : len);
+    if (r) return r;
+    return n < len ? -1 : 0;
+}
+
+// 归并排序（需要访问历史记录来比较，不能用qsort）
+static void sort_keys(_self, prefix_key *keys, usize n, prefix_key *tmp) {
+    for (usize width = 1; width < n; width *= 2) {
+        for (usize lo = 0; lo < n; lo += width * 2) {
+            usize mid = lo + width < n ? lo + width : n;
+            usize hi  = lo + width * 2 < n ? lo + width * 2 : n;
+            usize i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                tmp[k++] = key_cmp(self, keys[j], keys[i]) < 0 ? keys[j++] : keys[i++];
+            }
+            while (i < mid) {
+                tmp[k++] = keys[i++];
+            }
+            while (j < hi) {
+                tmp[k++] = keys[j++];
+            }
+        }
+        memcpy(keys, tmp, n * sizeof(prefix_key));
+    }
+}
+
+// 把排好序的 src[0, n) 归并进 dst[0, len)（dst 要有足够的容量），返回第一个变了的位置。
+// src 比 dst 短得多时逐个二分查找插入的位置，每条记录最多挪动一次
+static usize keys_merge(_self, prefix_key *dst, usize len, const prefix_key *src, usize n) {
+    usize i = len, j = n, k = len + n;
+    if (n < len / 16) {
+        while (j--) {
+            usize lo = 0, hi = i;
+            while (lo < hi) {
+                usize mid = (lo + hi) / 2;
+                if (key_cmp(self, dst[mid], src[j]) > 0) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            memmove(dst + lo + j + 1, dst + lo, (i - lo) * sizeof(prefix_key));
+            dst[lo + j] = src[j];
+            i           = lo;
+        }
+        return i;
+    }
+    while (j) {
+        if (i && key_cmp(self, dst[i - 1], src[j - 1]) > 0) {
+            dst[--k] = dst[--i];
+        } else {
+            dst[--k] = src[--j];
+        }
+    }
+    return k;
+}
+
+// 重新计算 sorted[from, to) 对应的叶子和它们的祖先，to 可以超过 sorted 的长度（清空多出来的叶子）
+static void tree_update(pl_readline_prefix_t prefix, usize from, usize to) {
+    if (from >= to) return;
+    for (usize i = from; i < to; i++) {
+        uint32_t seq = i < prefix->sorted.len ? prefix->sorted.keys[i].seq : KEY_DEAD;
+        prefix->tree[prefix->tree_size + i] = seq & KEY_DEAD ? 0 : seq + 1;
+    }
+    for (usize lo = (prefix->tree_size + from) / 2, hi = (prefix->tree_size + to - 1) / 2; lo;
+         lo /= 2, hi /= 2) {
+        for (usize i = lo; i <= hi; i++) {
+            uint32_t a = prefix->tree[i * 2], b = prefix->tree[i * 2 + 1];
+            prefix->tree[i] = a > b ? a : b;
+        }
+    }
+}
+
+// 保证线段树放得下len条记录，放不下时换一棵大一倍的，按现在的 sorted 重新建立
+static bool tree_fit(pl_readline_prefix_t prefix, usize len) {
+    if (len <= prefix->tree_size) return true;
+    usize size = prefix->tree_size ? prefix->tree_size : 64;
+    while (size < len) {
+        size *= 2;
+    }
+    uint32_t *tree = calloc(size * 2, sizeof(uint32_t));
+    if (!tree) return false;
+    free(prefix->tree);
+    prefix->tree      = tree;
+    prefix->tree_size = size;
+    tree_update(prefix, 0, prefix->sorted.len);
+    return true;
+}
+
+// sorted[lo, hi) 中最大的序号
+static bool tree_max(pl_readline_prefix_t prefix, usize lo, usize hi, uint32_t *max) {
+    uint32_t best = 0;
+    for (lo += prefix->tree_size, hi += prefix->tree_size; lo < hi; lo /= 2, hi /= 2) {
+        if (lo & 1) {
+            if (prefix->tree[lo] > best) best = prefix->tree[lo];
+            lo++;
+        }
+        if (hi & 1) {
+            hi--;
+            if (prefix->tree[hi] > best) best = prefix->tree[hi];
+        }
+    }
+    if (!best) return false;
+    *max = best - 1;
+    return true;
+}
+
+// 把排好序的 src[0, n) 合并进主体
+static bool sorted_merge(_self, const prefix_key *src, usize n) {
+    pl_readline_prefix_t prefix = self->prefix;
+    usize                len    = prefix->sorted.len + n;
+    if (!n) return true;
+    if (!keys_reserve(&prefix->sorted, len) || !tree_fit(prefix, len)) return false;
+    usize from = keys_merge(self, prefix->sorted.keys, prefix->sorted.len, src, n);
+    prefix->sorted.len = len;
+    tree_update(prefix, from, len);
+    prefix->version++;
+    return true;
+}
+
+// 归并 bulk 的最后两段，每次最多移动 MERGE_STEP 条，没有归并完时下一次接着做
+#define MERGE_STEP 4096
+
+static bool bulk_collapse(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    usize                n      = prefix->bulk_ends_len;
+    usize                lo     = n > 2 ? prefix->bulk_ends[n - 3] : 0;
+    usize                mid    = prefix->bulk_ends[n - 2];
+    usize                hi     = prefix->bulk_ends[n - 1];
+    prefix_key          *keys   = prefix->bulk.keys;
+    if (!prefix->merge_tmp) {
+        // 中途放弃时要分成三段，先留好位置
+        if (!seqs_reserve(&prefix->bulk_ends, &prefix->bulk_ends_cap, n + 1)) return false;
+        if (!(prefix->merge_tmp = malloc((hi - mid) * sizeof(prefix_key)))) return false;
+        memcpy(prefix->merge_tmp, keys + mid, (hi - mid) * sizeof(prefix_key));
+        prefix->merge_len = hi - mid;
+        prefix->merge_i   = mid;
+        prefix->merge_j   = hi - mid;
+    }
+    // 从后往前归并，写到 [i + j] 的前一个位置
+    usize       i   = prefix->merge_i, j = prefix->merge_j;
+    prefix_key *tmp = prefix->merge_tmp;
+    for (usize step = 0; j && step < MERGE_STEP; step++) {
+        if (i > lo && key_cmp(self, keys[i - 1], tmp[j - 1]) > 0) {
+            keys[i + j - 1] = keys[i - 1];
+            i--;
+        } else {
+            keys[i + j - 1] = tmp[j - 1];
+            j--;
+        }
+    }
+    prefix->merge_i = i;
+    prefix->merge_j = j;
+    if (j) return true;
+    free(prefix->merge_tmp);
+    prefix->merge_tmp        = NULL;
+    prefix->merge_len        = 0;
+    prefix->bulk_ends[n - 2] = hi;
+    prefix->bulk_ends_len--;
+    return true;
+}
+
+// 放弃没有归并完的两段：把副本剩下的部分放回空出来的位置，分成三段各自有序的记录
+static void bulk_abort(pl_readline_prefix_t prefix) {
+    if (!prefix->merge_tmp) return;
+    usize n  = prefix->bulk_ends_len;
+    usize lo = n > 2 ? prefix->bulk_ends[n - 3] : 0;
+    usize hi = prefix->bulk_ends[n - 1];
+    usize i = prefix->merge_i, k = prefix->merge_i + prefix->merge_j;
+    memcpy(prefix->bulk.keys + i, prefix->merge_tmp, prefix->merge_j * sizeof(prefix_key));
+    n -= 2;
+    if (i > lo) prefix->bulk_ends[n++] = i;
+    prefix->bulk_ends[n++] = k;
+    if (hi > k) prefix->bulk_ends[n++] = hi;
+    prefix->bulk_ends_len = n;
+    free(prefix->merge_tmp);
+    prefix->merge_tmp = NULL;
+    prefix->merge_len = 0;
+}
+
+// 去掉序号为drop的记录，drop为UINT64_MAX时去掉所有已经不在了的（包括标记删除的）。
+// ends不为NULL时keys分成了好几段，各段的结尾也跟着调整（变空的段去掉）；返回第一个变了的位置
+static usize keys_filter(_self, prefix_keys *keys, uint32_t *ends, usize *ends_len, uint64_t drop) {
+    usize from = keys->len, k = 0, runs = 0, start = 0, idx;
+    usize count = ends ? *ends_len : 1;
+    for (usize r = 0; r < count; r++) {
+        usize end = ends ? ends[r] : keys->len, kept = k;
+        for (usize i = start; i < end; i++) {
+            prefix_key key = keys->keys[i];
+            if (drop == UINT64_MAX ? pl_readline_history_find(self->history, key.seq, &idx)
+                                   : key.seq != drop) {
+                keys->keys[k++] = key;
+            } else if (from == keys->len) {
+                from = i;
+            }
+        }
+        if (ends && k > kept) ends[runs++] = k;
+        start = end;
+    }
+    keys->len = k;
+    if (ends) *ends_len = runs;
+    return from;
+}
+
+// 放掉 bulk_gone 留着的内容
+static void bulk_gone_clear(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    for (usize i = 0; i < prefix->bulk_gone.len; i++) {
+        pl_readline_history_line_drop(self->history, prefix->bulk_gone.keys[i].line);
+    }
+    prefix->bulk_gone.len = 0;
+}
+
+// 逐个检查，去掉所有已经不在的记录；历史记录一次删掉的太多、来不及按内容删时用
+static void index_prune_all(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    bulk_gone_clear(self); // bulk 里的下面一起去掉
+    usize                len    = prefix->sorted.len;
+    usize                from   = keys_filter(self, &prefix->sorted, NULL, NULL, UINT64_MAX);
+    if (from < len) {
+        tree_update(prefix, from, len);
+        prefix->version++;
+    }
+    prefix->dead = 0;
+    keys_filter(self, &prefix->run, NULL, NULL, UINT64_MAX);
+    bulk_abort(prefix);
+    keys_filter(self, &prefix->bulk, prefix->bulk_ends, &prefix->bulk_ends_len, UINT64_MAX);
+    usize n = 0, idx;
+    for (usize i = 0; i < prefix->pending_len; i++) {
+        if (pl_readline_history_find(self->history, prefix->pending[i], &idx))
+            prefix->pending[n++] = prefix->pending[i];
+    }
+    prefix->pending_len = n;
+}
+
+// 在主体里删掉key：和它相等的一组（包括标记删除的副本）换成相邻记录的副本并标记删除。
+// 不在主体里返回false
+static bool sorted_remove(_self, prefix_key key) {
+    pl_readline_prefix_t prefix = self->prefix;
+    prefix_key          *keys   = prefix->sorted.keys;
+    usize                len    = prefix->sorted.len;
+    usize                lo = 0, hi = len;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (key_cmp(self, keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    usize live = 0;
+    for (hi = lo; hi < len && key_cmp(self, keys[hi], key) == 0; hi++) {
+        if (!(keys[hi].seq & KEY_DEAD)) live++;
+    }
+    if (!live) return false;
+    if (!lo && hi == len) { // 剩下的都删掉了
+        prefix->sorted.len = 0;
+        prefix->dead       = 0;
+    } else {
+        prefix_key copy  = lo ? keys[lo - 1] : keys[hi];
+        copy.seq        |= KEY_DEAD;
+        for (usize i = lo; i < hi; i++) {
+            keys[i] = copy;
+        }
+        prefix->dead += live;
+    }
+    tree_update(prefix, lo, hi);
+    prefix->version++;
+    return true;
+}
+
+// 从索引里删掉一条记录，key.line 必须还没有被释放
+static void index_remove(_self, prefix_key key) {
+    pl_readline_prefix_t prefix = self->prefix;
+    for (usize i = 0; i < prefix->pending_len; i++) {
+        if (prefix->pending[i] != key.seq) continue;
+        prefix->pending[i] = prefix->pending[--prefix->pending_len]; // 已经拿出来了
+        return;
+    }
+    if (sorted_remove(self, key)) return;
+    usize n = prefix->run.len;
+    if (keys_filter(self, &prefix->run, NULL, NULL, key.seq) < n) return;
+    if (!prefix->bulk.len) return;
+    if (keys_reserve(&prefix->bulk_gone, prefix->bulk_gone.len + 1)) { // 在 bulk 里
+        pl_readline_history_line_hold(self->history, key.line);
+        prefix->bulk_gone.keys[prefix->bulk_gone.len++] = key;
+        return;
+    }
+    bulk_abort(prefix);
+    keys_filter(self, &prefix->bulk, prefix->bulk_ends, &prefix->bulk_ends_len, key.seq);
+}
+
+// 处理历史记录淘汰和删掉的记录，它们的内容很快会被释放，之后不能再参与比较
+static void index_prune(_self) {
+    pl_readline_prefix_t prefix  = self->prefix;
+    uint64_t             removed = pl_readline_history_removed(self->history);
+    for (; prefix->removed < removed; prefix->removed++) {
+        uint64_t seq;
+        uint32_t line;
+        if (!pl_readline_history_removed_at(self->history, prefix->removed, &seq, &line)) {
+            index_prune_all(self);
+            break;
+        }
+        if (seq < prefix->indexed) index_remove(self, (prefix_key){(uint32_t)seq, line});
+    }
+    prefix->removed = removed;
+}
+
+// 插进run，满了先把run合并进主体
+static bool run_insert(_self, prefix_key key) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (prefix->run.len >= PL_READLINE_SUGGEST_RUN) {
+        if (!sorted_merge(self, prefix->run.keys, prefix->run.len)) return false;
+        prefix->run.len = 0;
+    }
+    if (!keys_reserve(&prefix->run, prefix->run.len + 1)) return false;
+    usize lo = 0, hi = prefix->run.len;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (key_cmp(self, prefix->run.keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    memmove(prefix->run.keys + lo + 1, prefix->run.keys + lo,
+            (prefix->run.len - lo) * sizeof(prefix_key));
+    prefix->run.keys[lo] = key;
+    prefix->run.len++;
+    return true;
+}
+
+// 把第 [from, from + n) 条记录排好序，作为新的一段放到 bulk 的末尾
+static bool bulk_append(_self, usize from, usize n) {
+    pl_readline_prefix_t prefix = self->prefix;
+    usize                len    = prefix->bulk.len;
+    prefix_key          *tmp    = malloc(n * sizeof(prefix_key));
+    if (!tmp || !keys_reserve(&prefix->bulk, len + n) ||
+        !seqs_reserve(&prefix->bulk_ends, &prefix->bulk_ends_cap, prefix->bulk_ends_len + 1)) {
+        free(tmp);
+        return false;
+    }
+    for (usize i = 0; i < n; i++) {
+        prefix->bulk.keys[len + i] = key_at(self, from + i);
+    }
+    sort_keys(self, prefix->bulk.keys + len, n, tmp);
+    free(tmp);
+    prefix->bulk.len                           += n;
+    prefix->bulk_ends[prefix->bulk_ends_len++]  = prefix->bulk.len;
+    return true;
+}
+
+// 整理索引的一步，每一步最多和索引的大小成正比；all为true时run也要合并进主体。
+// 没有要做的了返回0，内存不足返回-1
+static int index_step(_self, bool all) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (prefix->pending_len) { // 修改过的记录按新的内容放回去
+        usize idx;
+        if (pl_readline_history_find(self->history, prefix->pending[prefix->pending_len - 1], &idx) &&
+            !run_insert(self, key_at(self, idx)))
+            return -1;
+        prefix->pending_len--;
+        return 1;
+    }
+    usize count = pl_readline_history_count(self->history);
+    usize from  = pl_readline_history_lower_bound(self->history, prefix->indexed);
+    usize fresh = count - from;
+    if (fresh && !prefix->bulk.len && fresh <= PL_READLINE_SUGGEST_RUN) { // 刚提交的几条
+        for (usize i = from; i < count; i++) {
+            if (!run_insert(self, key_at(self, i))) return -1;
+            prefix->indexed = pl_readline_history_seq(self->history, i + 1);
+        }
+        return 1;
+    }
+    if (prefix->merge_tmp) return bulk_collapse(self) ? 1 : -1;
+    usize n = prefix->bulk_ends_len;
+    // 最后一段不比前一段短时归并它们，段数保持在 O(log n)
+    if (n > 1 && prefix->bulk_ends[n - 1] - prefix->bulk_ends[n - 2] >=
+                     prefix->bulk_ends[n - 2] - (n > 2 ? prefix->bulk_ends[n - 3] : 0))
+        return bulk_collapse(self) ? 1 : -1;
+    if (fresh) {
+        usize chunk = fresh < PL_READLINE_SUGGEST_RUN ? fresh : PL_READLINE_SUGGEST_RUN;
+        if (!bulk_append(self, from, chunk)) return -1;
+        prefix->indexed = pl_readline_history_seq(self->history, from + chunk);
+        return 1;
+    }
+    if (n > 1) return bulk_collapse(self) ? 1 : -1;
+    if (n) { // 排好了，合并进主体
+        if (!prefix->sorted.len) { // 主体是空的，直接换过来
+            prefix_keys sorted = prefix->sorted;
+            if (!tree_fit(prefix, prefix->bulk.len)) return -1;
+            prefix->sorted = prefix->bulk;
+            prefix->bulk   = sorted;
+            tree_update(prefix, 0, prefix->sorted.len);
+            prefix->version++;
+        } else if (!sorted_merge(self, prefix->bulk.keys, prefix->bulk.len)) {
+            return -1;
+        }
+        prefix->bulk.len      = 0;
+        prefix->bulk_ends_len = 0;
+        for (usize i = 0; i < prefix->bulk_gone.len; i++) {
+            sorted_remove(self, prefix->bulk_gone.keys[i]);
+        }
+        bulk_gone_clear(self);
+        return 1;
+    }
+    if (prefix->dead && prefix->dead >= prefix->sorted.len / 4) { // 清掉标记删除的记录
+        usize len = prefix->sorted.len, k = 0, from = len;
+        for (usize i = 0; i < len; i++) {
+            if (!(prefix->sorted.keys[i].seq & KEY_DEAD)) {
+                prefix->sorted.keys[k++] = prefix->sorted.keys[i];
+            } else if (from == len) {
+                from = i;
+            }
+        }
+        prefix->sorted.len = k;
+        prefix->dead       = 0;
+        tree_update(prefix, from, len);
+        prefix->version++;
+        return 1;
+    }
+    if (all && prefix->run.len) {
+        if (!sorted_merge(self, prefix->run.keys, prefix->run.len)) return -1;
+        prefix->run.len = 0;
+        return 1;
+    }
+    return 0;
+}
+
+#if PL_ENABLE_POSIX
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+// 整理索引：all为true时一次做完，否则最多花 PL_READLINE_SUGGEST_BUDGET 微秒，剩下的留到下一次。
+// 内存不足时返回false
+static bool index_update(_self, bool all) {
+    index_prune(self);
+#if PL_ENABLE_POSIX
+    uint64_t deadline = now_us() + PL_READLINE_SUGGEST_BUDGET;
+#else
+    usize steps = 0; // 没有时钟，每次最多做几步
+#endif
+    for (;;) {
+        int ret = index_step(self, all);
+        if (ret <= 0) return ret == 0;
+        if (all) continue;
+#if PL_ENABLE_POSIX
+        if (now_us() >= deadline) return true;
+#else
+        if (++steps >= 8) return true;
+#endif
+    }
+}
+
+// 第seq条记录要被修改了：按旧的内容从索引里拿出来，整理时再按新的内容放回去
+void pl_readline_prefix_touch(_self, uint64_t seq) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!prefix || seq >= prefix->indexed) return; // 还没有放进索引，以后会按新的内容放进去
+    for (usize i = 0; i < prefix->pending_len; i++) {
+        if (prefix->pending[i] == seq) return; // 已经拿出来了
+    }
+    if (!seqs_reserve(&prefix->pending, &prefix->pending_cap, prefix->pending_len + 1)) return;
+    index_prune(self);
+    usize idx;
+    if (!pl_readline_history_find(self->history, seq, &idx)) return;
+    index_remove(self, key_at(self, idx)); // 还是旧的内容
+    prefix->pending[prefix->pending_len++] = seq;
+}
+
+// keys[lo, hi) 中以line开头的那一段
+static void prefix_range(_self, const prefix_key *keys, const char *line, usize len, usize lo,
+                         usize hi, usize *begin, usize *end) {
+    usize top = hi;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (prefix_cmp(self, keys[mid], line, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *begin = lo;
+    hi     = top;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (prefix_cmp(self, keys[mid], line, len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *end = lo;
+}
+
+// keys[lo, hi) 中和输入行（长度为n）完全一样的记录排在最前面，返回它们之后的位置
+static usize skip_exact(_self, const prefix_key *keys, usize lo, usize hi, usize n) {
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2, mid_len;
+        key_line(self, keys[mid], &mid_len);
+        if (mid_len == n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void heap_push(pl_readline_prefix_t prefix, usize lo, usize hi) {
+    nav_range range = {.lo = lo, .hi = hi};
+    if (!tree_max(prefix, lo, hi, &range.seq)) return; // 空区间
+    usize i = prefix->heap_len++;
+    while (i && prefix->heap[(i - 1) / 2].seq < range.seq) {
+        prefix->heap[i] = prefix->heap[(i - 1) / 2];
+        i               = (i - 1) / 2;
+    }
+    prefix->heap[i] = range;
+}
+
+static nav_range heap_pop(pl_readline_prefix_t prefix) {
+    nav_range top  = prefix->heap[0];
+    nav_range last = prefix->heap[--prefix->heap_len];
+    usize     i    = 0;
+    for (;;) {
+        usize child = i * 2 + 1;
+        if (child >= prefix->heap_len) break;
+        if (child + 1 < prefix->heap_len && prefix->heap[child + 1].seq > prefix->heap[child].seq)
+            child++;
+        if (prefix->heap[child].seq <= last.seq) break;
+        prefix->heap[i] = prefix->heap[child];
+        i               = child;
+    }
+    if (prefix->heap_len) prefix->heap[i] = last;
+    return top;
+}
+
+// 每弹出一个区间最多放回两个，堆里的区间数不会超过翻过的条数加一
+static bool heap_reserve(pl_readline_prefix_t prefix, usize len) {
+    if (len <= prefix->heap_cap) return true;
+    usize      cap  = prefix->heap_cap ? prefix->heap_cap * 2 : 16;
+    nav_range *heap = realloc(prefix->heap, cap * sizeof(nav_range));
+    if (!heap) return false;
+    prefix->heap     = heap;
+    prefix->heap_cap = cap;
+    return true;
+}
+
+static pl_readline_prefix_t prefix_get(_self) {
+    if (self->prefix) return self->prefix;
+    if (!(self->prefix = calloc(1, sizeof(struct pl_readline_prefix)))) return NULL;
+    self->prefix->removed = pl_readline_history_removed(self->history); // 之前删掉的都还没放进索引
+    pl_readline_history_watch(self->history, true); // 之后删掉的记录要按内容从索引里删掉
+    return self->prefix;
+}
+
+// 把以输入行开头的那一段整个放进堆里；翻看中途索引变了也从这里重新开始，
+// 已经翻过的记录靠序号比上一次翻到的小来排除
+static bool nav_fill(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!index_update(self, true) || !heap_reserve(prefix, 1)) return false;
+    const char *line = self->history_line ? self->history_line : "";
+    usize       len  = strlen(line);
+    usize       begin, end;
+    prefix_range(self, prefix->sorted.keys, line, len, 0, prefix->sorted.len, &begin, &end);
+    if (len) begin = skip_exact(self, prefix->sorted.keys, begin, end, len); // 翻到了也看不出变化
+    prefix->heap_len    = 0;
+    prefix->nav_version = prefix->version;
+    heap_push(prefix, begin, end);
+    return true;
+}
+
+// 从输入行开始翻看
+static bool nav_start(_self) {
+    pl_readline_prefix_t prefix = prefix_get(self);
+    if (!prefix) return false;
+    prefix->visited_len = 0;
+    prefix->pos         = 0;
+    if (!nav_fill(self)) return false;
+    prefix->nav_active = true;
+    return true;
+}
+
+// 序号对应的 history_idx（倒数第几条），记录已经不在了返回0
+static int nav_idx_of(_self, uint32_t seq) {
+    usize idx;
+    if (!pl_readline_history_find(self->history, seq, &idx)) return 0;
+    return (int)(pl_readline_history_count(self->history) - idx);
+}
+
+// 下一条（更早的）内容和之前翻到的都不一样的记录，没有了返回false
+static bool nav_next(_self, uint32_t *seq) {
+    pl_readline_prefix_t prefix = self->prefix;
+    index_prune(self); // 翻看时历史记录上限被调小了
+    if (prefix->nav_version != prefix->version && !nav_fill(self)) return false;
+    uint32_t limit = prefix->visited_len ? prefix->visited[prefix->visited_len - 1] : UINT32_MAX;
+    while (prefix->heap_len) {
+        if (!heap_reserve(prefix, prefix->heap_len + 1)) return false;
+        nav_range  range = heap_pop(prefix);
+        prefix_key key   = {.seq = range.seq};
+        usize      idx;
+        pl_readline_history_find(self->history, range.seq, &idx);
+        key.line = pl_readline_history_line_id(self->history, idx);
+        // 区间里最新的一条是它那一组相同内容中的最后一条（后面可能还有它的删除副本），找到这一组的开头
+        usize lo = range.lo, hi = range.hi;
+        while (lo < hi) {
+            usize mid = (lo + hi) / 2;
+            if (key_cmp(self, prefix->sorted.keys[mid], key) <= 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        usize pos = lo; // 这一组之后
+        hi        = pos;
+        lo        = range.lo;
+        while (lo < hi) {
+            usize mid = (lo + hi) / 2;
+            if (prefix->sorted.keys[mid].line != key.line) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        heap_push(prefix, range.lo, lo);
+        heap_push(prefix, pos, range.hi);
+        if (range.seq >= limit) continue; // 重新建立堆之后，已经翻过的
+        *seq = range.seq;
+        return true;
+    }
+    return false;
+}
+
+static void nav_show(_self, int idx) {
+    pl_readline_prefix_t prefix = self->prefix;
+    usize                count  = pl_readline_history_count(self->history);
+    usize                len    = 0;
+    const char *line = idx ? pl_readline_history_get(self->history, count - idx, &len)
+                           : (self->history_line ? self->history_line : "");
+    if (!idx && self->history_line) len = strlen(self->history_line);
+    if (!pl_readline_buffer_set(self, line, len)) return;
+    self->ptr         = self->length;
+    self->history_idx = idx;
+    prefix->nav_idx   = idx;
+    redisplay_buffer_with_colors(self, 0);
+}
+
+static bool nav_valid(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    return prefix && prefix->nav_active && self->history_idx && prefix->nav_idx == self->history_idx;
+}
+
+// 上方向键：往前找下一条以输入行开头的记录，找不到返回false
+bool pl_readline_prefix_up(_self) {
+    if (!nav_valid(self)) {
+        if (self->history_idx) return false; // 不是从输入行开始翻的，按原来的方式
+        pl_readline_modify_history(self);
+        if (!nav_start(self)) return false;
+    } else {
+        pl_readline_modify_history(self);
+    }
+    pl_readline_prefix_t prefix = self->prefix;
+    if (prefix->pos == prefix->visited_len) {
+        uint32_t seq;
+        if (!nav_next(self, &seq)) return true; // 没有更早的了，停在这里
+        if (!seqs_reserve(&prefix->visited, &prefix->visited_cap, prefix->visited_len + 1))
+            return true;
+        prefix->visited[prefix->visited_len++] = seq;
+    }
+    int idx = nav_idx_of(self, prefix->visited[prefix->pos]);
+    if (!idx) return true;
+    prefix->pos++;
+    nav_show(self, idx);
+    return true;
+}
+
+// 下方向键：回到上一次翻到的较新的记录，最后回到输入行
+bool pl_readline_prefix_down(_self) {
+    if (!nav_valid(self)) return false;
+    pl_readline_prefix_t prefix = self->prefix;
+    pl_readline_modify_history(self);
+    if (prefix->pos == 1) {
+        prefix->pos = 0;
+        nav_show(self, 0);
+        prefix->nav_active = false;
+        return true;
+    }
+    int idx = nav_idx_of(self, prefix->visited[prefix->pos - 2]);
+    if (!idx) return true;
+    prefix->pos--;
+    nav_show(self, idx);
+    return true;
+}
+
+// 以输入行开头、比输入行长的最新一条记录，返回它比输入行多出来的部分
+static const char *suggest_find(_self, usize *len) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!index_update(self, false)) return NULL;
+    const char *line = pl_readline_buffer_view(self);
+    usize       n    = self->length;
+    usize       lo = 0, hi = prefix->sorted.len;
+    // 输入行是在上一次的基础上变长的，只需要在上一次的范围里找
+    if (prefix->query && prefix->query_version == prefix->version && prefix->query_len <= n &&
+        !memcmp(prefix->query, line, prefix->query_len)) {
+        lo = prefix->query_lo;
+        hi = prefix->query_hi;
+    }
+    prefix_range(self, prefix->sorted.keys, line, n, lo, hi, &lo, &hi);
+    if (n > prefix->query_cap) {
+        char *query = realloc(prefix->query, n);
+        if (query) {
+            prefix->query     = query;
+            prefix->query_cap = n;
+        }
+    }
+    if (n <= prefix->query_cap) {
+        memcpy(prefix->query, line, n);
+        prefix->query_len     = n;
+        prefix->query_lo      = lo;
+        prefix->query_hi      = hi;
+        prefix->query_version = prefix->version;
+    }
+    uint32_t seq;
+    bool     found = tree_max(prefix, skip_exact(self, prefix->sorted.keys, lo, hi, n), hi, &seq);
+    // run很短，直接看一遍
+    prefix_range(self, prefix->run.keys, line, n, 0, prefix->run.len, &lo, &hi);
+    for (usize i = skip_exact(self, prefix->run.keys, lo, hi, n); i < hi; i++) {
+        if (!found || prefix->run.keys[i].seq > seq) seq = prefix->run.keys[i].seq;
+        found = true;
+    }
+    if (!found) return NULL;
+    usize       seq_len;
+    const char *match = entry_line(self, seq, &seq_len);
+    *len              = seq_len - n;
+    return match + n;
+}
+
+// 重绘之前调用：更新显示在输入行后面的建议
+void pl_readline_suggest_refresh(_self) {
+    if (pl_readline_search_active(self)) { // 搜索的提示占用了 annotation
+        if (self->prefix) self->prefix->shown = false;
+        return;
+    }
+    const char *suffix = NULL;
+    usize       len    = 0;
+    if (self->history_idx == 0 && self->ptr == self->length && self->length && prefix_get(self) &&
+        !self->prefix->hidden) {
+        suffix = suggest_find(self, &len);
+    }
+    pl_readline_prefix_t prefix = self->prefix;
+    if (suffix) {
+        pl_readline_set_annotation(self, suffix, len, PL_COLOR_GRAY);
+        prefix->shown = true;
+    } else if (prefix && prefix->shown) {
+        pl_readline_set_annotation(self, NULL, 0, PL_COLOR_RESET);
+        prefix->shown = false;
+    }
+}
+
+// 接受建议（右方向键、End），没有建议时返回false
+bool pl_readline_suggest_accept(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!prefix || !prefix->shown || self->ptr != self->length) return false;
+    if (!pl_readline_buffer_insert(self, self->ptr, self->annotation, self->annotation_len))
+        return false;
+    self->ptr += self->annotation_len;
+    redisplay_buffer_with_colors(self, 0);
+    return true;
+}
+
+// 暂时关掉建议，屏幕上的建议会被擦掉
+void pl_readline_suggest_enable(_self, bool enable) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!prefix) return; // 还没有显示过建议
+    prefix->hidden = !enable;
+    if (!enable && prefix->shown) redisplay_buffer_with_colors(self, 0);
+}
+
+// 占用的内存（字节）
+usize pl_readline_prefix_memory(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!prefix) return 0;
+    return sizeof(struct pl_readline_prefix) +
+           (prefix->sorted.cap + prefix->run.cap + prefix->bulk.cap + prefix->bulk_gone.cap +
+            prefix->merge_len) *
+               sizeof(prefix_key) +
+           (prefix->bulk_ends_cap + prefix->pending_cap + prefix->tree_size * 2 +
+            prefix->visited_cap) *
+               sizeof(uint32_t) +
+           prefix->heap_cap * sizeof(nav_range) + prefix->query_cap;
+}
+
+// 一行结束后释放翻看用的大块内存，索引留着
+void pl_readline_prefix_trim(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!prefix) return;
+    prefix->nav_active  = false;
+    prefix->heap_len    = 0;
+    prefix->visited_len = 0;
+    prefix->pos         = 0;
+    if (prefix->heap_cap * sizeof(nav_range) > PL_READLINE_IDLE_KEEP) {
+        free(prefix->heap);
+        prefix->heap     = NULL;
+        prefix->heap_cap = 0;
+    }
+    if (prefix->visited_cap * sizeof(uint32_t) > PL_READLINE_IDLE_KEEP) {
+        free(prefix->visited);
+        prefix->visited     = NULL;
+        prefix->visited_cap = 0;
+    }
+    if (!prefix->bulk.len) { // 大量记录都已经合并进主体
+        keys_free(&prefix->bulk);
+        keys_free(&prefix->bulk_gone);
+        free(prefix->bulk_ends);
+        prefix->bulk_ends     = NULL;
+        prefix->bulk_ends_cap = 0;
+    }
+}
+
+void pl_readline_prefix_free(_self) {
+    pl_readline_prefix_t prefix = self->prefix;
+    if (!prefix) return;
+    bulk_gone_clear(self);
+    keys_free(&prefix->sorted);
+    keys_free(&prefix->run);
+    keys_free(&prefix->bulk);
+    keys_free(&prefix->bulk_gone);
+    free(prefix->bulk_ends);
+    free(prefix->merge_tmp);
+    free(prefix->pending);
+    free(prefix->heap);
+    free(prefix->visited);
+    free(prefix->tree);
+    free(prefix->query);
+    free(prefix);
+    self->prefix = NULL;
+    pl_readline_history_watch(self->history, false);
+}
@@ -0,0 +1,541 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_search.c : 历史记录的增量搜索（Ctrl-R / Ctrl-S）
+//
+// 每条历史记录按三个字符一组（trigram）建立倒排索引，记录用序号表示，
+// 所以每个 trigram 的记录列表天然是有序的，新记录只需要追加到末尾。
+// 查询至少有三个字符时，取各个 trigram 列表的交集再逐条确认；
+// 查询变长时只在上一次的结果里过滤，退格时直接回到上一层的结果。
+// 第一次按 Ctrl-R 时才建立索引，之后每提交一行就把它加进索引。
+
+#define _GNU_SOURCE
+#include "pl_readline.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct trigram_postings {
+    uint32_t  key;  // 三个字符，0表示空槽位
+    uint32_t  len;
+    uint32_t  cap;
+    uint32_t *seqs; // 含有这个 trigram 的记录的序号，递增
+} trigram_postings;
+
+// 查询的每个长度对应一层
+typedef struct search_level {
+    uint64_t  match;     // 当前匹配的记录序号
+    usize     match_pos; // 匹配在这一行中的位置
+    bool      has_match;
+    bool      failing;   // 这一层没有找到匹配
+    uint32_t *results;   // 所有匹配的记录序号（递增），查询不足三个字符时为NULL
+    usize     count;
+} search_level;
+
+struct pl_readline_search {
+    // 索引
+    trigram_postings *table;
+    usize             size;    // 哈希表大小，2的幂
+    usize             used;
+    uint64_t          indexed; // 已经建立索引的记录序号（不含）
+    uint32_t         *dirty;   // 建立索引之后又被修改过的记录，搜索时逐条检查
+    usize             dirty_len;
+    usize             dirty_cap;
+
+    // 搜索状态
+    bool          active;
+    bool          forward; // Ctrl-S
+    char         *query;
+    usize         query_len;
+    usize         query_cap;
+    search_level *levels; // levels[i] 对应长度为i的查询
+    usize         levels_cap;
+    char         *saved_line; // 开始搜索前的输入行，取消时恢复
+    char         *last_query; // 上一次搜索的内容，空查询时再按 Ctrl-R 会用到
+};
+
+static uint32_t trigram_key(const char *p) {
+    return (uint32_t)(uint8_t)p[0] << 16 | (uint32_t)(uint8_t)p[1] << 8 | (uint8_t)p[2];
+}
+
+static usize trigram_slot(uint32_t key, usize size) {
+    return (key * 2654435761u) & (size - 1);
+}
+
+static trigram_postings *trigram_find(pl_readline_search_t search, uint32_t key) {
+    if (!search->size) return NULL;
+    for (usize i = trigram_slot(key, search->size);; i = (i + 1) & (search->size - 1)) {
+        if (search->table[i].key == key) return &search->table[i];
+        if (!search->table[i].key) return NULL;
+    }
+}
+
+static bool trigram_grow(pl_readline_search_t search) {
+    usize             size  = search->size ? search->size * 2 : 1024;
+    trigram_postings *table = calloc(size, sizeof(trigram_postings));
+    if (!table) return false;
+    for (usize i = 0; i < search->size; i++) {
+        if (!search->table[i].key) continue;
+        usize j = trigram_slot(search->table[i].key, size);
+        while (table[j].key) {
+            j = (j + 1) & (size - 1);
+        }
+        table[j] = search->table[i];
+    }
+    free(search->table);
+    search->table = table;
+    search->size  = size;
+    return true;
+}
+
+static trigram_postings *trigram_insert(pl_readline_search_t search, uint32_t key) {
+    if ((search->used + 1) * 2 > search->size && !trigram_grow(search)) return NULL;
+    usize i = trigram_slot(key, search->size);
+    while (search->table[i].key && search->table[i].key != key) {
+        i = (i + 1) & (search->size - 1);
+    }
+    if (!search->table[i].key) {
+        search->table[i].key = key;
+        search->used++;
+    }
+    return &search->table[i];
+}
+
+// 列表中第一个不小于seq的位置
+static usize lower_bound(const uint32_t *seqs, usize len, uint64_t seq) {
+    usize lo = 0, hi = len;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (seqs[mid] < seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void postings_append(trigram_postings *postings, uint32_t seq, uint64_t first_seq) {
+    if (postings->len && postings->seqs[postings->len - 1] == seq) return; // 同一行里重复的
+    if (postings->len == postings->cap) {
+        // 已经被淘汰的记录占了一半以上时先清理掉
+        usize stale = lower_bound(postings->seqs, postings->len, first_seq);
+        if (stale * 2 > postings->len) {
+            memmove(postings->seqs, postings->seqs + stale,
+                    (postings->len - stale) * sizeof(uint32_t));
+            postings->len -= stale;
+        } else {
+            uint32_t  cap  = postings->cap ? postings->cap * 2 : 4;
+            uint32_t *seqs = realloc(postings->seqs, cap * sizeof(uint32_t));
+            if (!seqs) return;
+            postings->seqs = seqs;
+            postings->cap  = cap;
+        }
+    }
+    postings->seqs[postings->len++] = seq;
+}
+
+// 序号为seq的记录，已经不在了返回NULL
+static const char *entry_line(_self, uint64_t seq, usize *len) {
+    usize idx;
+    if (!pl_readline_history_find(self->history, seq, &idx)) return NULL;
+    return pl_readline_history_get(self->history, idx, len);
+}
+
+// 把还没有索引的记录加进索引
+static void index_update(_self) {
+    pl_readline_search_t search = self->search;
+    uint64_t             first  = pl_readline_history_first_seq(self->history);
+    usize                count  = pl_readline_history_count(self->history);
+    for (usize idx = pl_readline_history_lower_bound(self->history, search->indexed); idx < count;
+         idx++) {
+        usize       len;
+        uint64_t    seq  = pl_readline_history_seq(self->history, idx);
+        const char *line = pl_readline_history_get(self->history, idx, &len);
+        for (usize i = 0; i + 3 <= len; i++) {
+            trigram_postings *postings = trigram_insert(search, trigram_key(line + i));
+            if (postings) postings_append(postings, seq, first);
+        }
+    }
+    search->indexed = pl_readline_history_end_seq(self->history);
+}
+
+static pl_readline_search_t search_get(_self) {
+    if (!self->search) self->search = calloc(1, sizeof(struct pl_readline_search));
+    return self->search;
+}
+
+// 提交了新的一行，索引已经建立的话就顺便加进去
+void pl_readline_search_index_add(_self) {
+    if (self->search && self->search->size) index_update(self);
+}
+
+// 第seq条记录被修改了
+void pl_readline_search_touch(_self, uint64_t seq) {
+    pl_readline_search_t search = self->search;
+    if (!search || seq >= search->indexed) return;
+    for (usize i = 0; i < search->dirty_len; i++) {
+        if (search->dirty[i] == seq) return;
+    }
+    if (search->dirty_len == search->dirty_cap) {
+        usize     cap   = search->dirty_cap ? search->dirty_cap * 2 : 8;
+        uint32_t *dirty = realloc(search->dirty, cap * sizeof(uint32_t));
+        if (!dirty) return;
+        search->dirty     = dirty;
+        search->dirty_cap = cap;
+    }
+    search->dirty[search->dirty_len++] = seq;
+}
+
+// 第seq条记录中查询出现的位置，没有出现返回-1
+static isize match_at(_self, uint64_t seq) {
+    pl_readline_search_t search = self->search;
+    usize                len;
+    const char          *line = entry_line(self, seq, &len);
+    if (!line) return -1;
+    const char *p = memmem(line, len, search->query, search->query_len);
+    return p ? p - line : -1;
+}
+
+static bool results_push(search_level *level, usize *cap, uint32_t seq) {
+    if (level->count == *cap) {
+        usize     new_cap = *cap ? *cap * 2 : 64;
+        uint32_t *results = realloc(level->results, new_cap * sizeof(uint32_t));
+        if (!results) return false;
+        level->results = results;
+        *cap           = new_cap;
+    }
+    level->results[level->count++] = seq;
+    return true;
+}
+
+static int cmp_postings(const void *a, const void *b) {
+    uint32_t x = (*(trigram_postings *const *)a)->len, y = (*(trigram_postings *const *)b)->len;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_seq(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 用索引求出所有匹配当前查询（至少三个字符）的记录
+static void results_from_index(_self, search_level *level) {
+    pl_readline_search_t search = self->search;
+    uint64_t             first  = pl_readline_history_first_seq(self->history);
+    usize                n      = search->query_len - 2, cap = 0;
+    trigram_postings   **lists  = malloc(n * sizeof(trigram_postings *));
+    if (!lists) return;
+    for (usize i = 0; i < n; i++) {
+        lists[i] = trigram_find(search, trigram_key(search->query + i));
+        if (!lists[i]) n = 0; // 有一个 trigram 从来没出现过
+    }
+    // 从最短的列表开始，在其余列表中二分查找
+    qsort(lists, n, sizeof(trigram_postings *), cmp_postings);
+    for (usize k = n ? lower_bound(lists[0]->seqs, lists[0]->len, first) : 0; n && k < lists[0]->len;
+         k++) {
+        uint32_t seq = lists[0]->seqs[k];
+        usize    i   = 1;
+        while (i < n) {
+            usize at = lower_bound(lists[i]->seqs, lists[i]->len, seq);
+            if (at == lists[i]->len || lists[i]->seqs[at] != seq) break;
+            i++;
+        }
+        if (i == n && match_at(self, seq) >= 0) results_push(level, &cap, seq);
+    }
+    free(lists);
+    // 修改过的记录不一定在索引里
+    usize indexed = level->count;
+    for (usize i = 0; i < search->dirty_len; i++) {
+        uint32_t seq = search->dirty[i];
+        usize    at  = lower_bound(level->results, indexed, seq);
+        if ((at == indexed || level->results[at] != seq) && match_at(self, seq) >= 0) {
+            results_push(level, &cap, seq);
+        }
+    }
+    if (level->count > indexed) qsort(level->results, level->count, sizeof(uint32_t), cmp_seq);
+}
+
+// 查询变长了，在上一层的结果里过滤
+static void results_narrow(_self, const search_level *prev, search_level *level) {
+    usize cap = 0;
+    for (usize i = 0; i < prev->count; i++) {
+        if (match_at(self, prev->results[i]) >= 0) results_push(level, &cap, prev->results[i]);
+    }
+}
+
+// 从from开始（含）往旧或往新的方向找匹配的记录
+static bool find_match(_self, search_level *level, uint64_t from, bool forward) {
+    uint64_t first = pl_readline_history_first_seq(self->history);
+    uint64_t end   = pl_readline_history_end_seq(self->history);
+    if (from < first) {
+        if (!forward) return false;
+        from = first;
+    }
+    if (from >= end) {
+        if (forward) return false;
+        from = end - 1;
+    }
+    if (level->results) {
+        usize at = lower_bound(level->results, level->count, from);
+        if (forward) {
+            for (; at < level->count && level->results[at] < first; at++) {}
+            if (at == level->count) return false;
+        } else {
+            if (at == level->count || level->results[at] != from) {
+                if (at == 0) return false;
+                at--;
+            }
+            if (level->results[at] < first) return false;
+        }
+        level->match = level->results[at];
+    } else { // 查询太短，直接逐条找
+        usize count = pl_readline_history_count(self->history);
+        usize idx   = pl_readline_history_lower_bound(self->history, from);
+        if (!forward && (idx == count || pl_readline_history_seq(self->history, idx) != from)) {
+            if (!idx) return false;
+            idx--;
+        }
+        if (idx == count) return false;
+        while (match_at(self, pl_readline_history_seq(self->history, idx)) < 0) {
+            if (forward ? idx + 1 >= count : idx == 0) return false;
+            idx += forward ? 1 : -1;
+        }
+        level->match = pl_readline_history_seq(self->history, idx);
+    }
+    level->match_pos = match_at(self, level->match);
+    level->has_match = true;
+    return true;
+}
+
+// 把当前匹配显示出来，搜索状态画在输入行后面
+static void search_show(_self) {
+    pl_readline_search_t search = self->search;
+    search_level        *level  = &search->levels[search->query_len];
+    if (level->has_match) {
+        usize       len;
+        const char *line = entry_line(self, level->match, &len);
+        if (line && pl_readline_buffer_set(self, line, len)) self->ptr = level->match_pos;
+    } else if (!search->query_len) {
+        pl_readline_buffer_set(self, search->saved_line, strlen(search->saved_line));
+        self->ptr = self->length;
+    }
+    const char *name  = search->forward ? "i-search" : "reverse-i-search";
+    usize       len   = strlen(name) + search->query_len + 16;
+    char       *label = malloc(len);
+    if (label) {
+        len = sprintf(label, "  (%s%s)'", level->failing ? "failing " : "", name);
+        if (search->query_len) memcpy(label + len, search->query, search->query_len);
+        len        += search->query_len;
+        label[len++] = '\'';
+        pl_readline_set_annotation(self, label, len, PL_COLOR_GRAY);
+        free(label);
+    }
+    redisplay_buffer_with_colors(self, 0);
+}
+
+static bool levels_reserve(pl_readline_search_t search, usize len) {
+    if (len < search->levels_cap) return true;
+    usize         cap    = search->levels_cap ? search->levels_cap * 2 : 16;
+    search_level *levels = realloc(search->levels, cap * sizeof(search_level));
+    if (!levels) return false;
+    search->levels     = levels;
+    search->levels_cap = cap;
+    return true;
+}
+
+static bool query_reserve(pl_readline_search_t search, usize len) {
+    if (len <= search->query_cap) return true;
+    usize cap   = search->query_cap ? search->query_cap * 2 : 32;
+    char *query = realloc(search->query, cap);
+    if (!query) return false;
+    search->query     = query;
+    search->query_cap = cap;
+    return true;
+}
+
+// 查询后面加一个字符
+static void search_push(_self, char ch) {
+    pl_readline_search_t search = self->search;
+    if (!query_reserve(search, search->query_len + 1) ||
+        !levels_reserve(search, search->query_len + 1))
+        return;
+    search_level *prev = &search->levels[search->query_len];
+    search_level *level = &search->levels[search->query_len + 1];
+    search->query[search->query_len++] = ch;
+    *level                             = (search_level){0};
+    if (search->query_len >= 3) {
+        if (prev->results) {
+            results_narrow(self, prev, level);
+        } else {
+            results_from_index(self, level);
+        }
+        if (!level->results) level->results = malloc(sizeof(uint32_t)); // 空的结果也要和NULL区分
+    }
+    // 当前这一行还匹配就留在这里，否则继续往前找
+    uint64_t from = prev->has_match ? prev->match
+                    : search->forward ? pl_readline_history_first_seq(self->history)
+                                      : pl_readline_history_end_seq(self->history);
+    if (!find_match(self, level, from, search->forward)) {
+        level->failing   = true;
+        level->has_match = prev->has_match; // 保持显示上一个匹配
+        level->match     = prev->match;
+        level->match_pos = prev->match_pos;
+    }
+}
+
+static void search_pop(_self) {
+    pl_readline_search_t search = self->search;
+    if (!search->query_len) return;
+    free(search->levels[search->query_len].results);
+    search->query_len--;
+}
+
+// 找下一个匹配（Ctrl-R 往旧，Ctrl-S 往新）
+static void search_next(_self, bool forward) {
+    pl_readline_search_t search = self->search;
+    search_level        *level  = &search->levels[search->query_len];
+    search->forward             = forward;
+    if (!search->query_len) { // 空查询时用上一次搜索的内容
+        for (char *p = search->last_query; p && *p; p++) {
+            search_push(self, *p);
+        }
+        return;
+    }
+    if (!level->has_match) return;
+    uint64_t from = level->match;
+    if (forward ? from + 1 == 0 : from == 0) return;
+    search_level next = *level;
+    if (find_match(self, &next, forward ? from + 1 : from - 1, forward)) {
+        *level         = next;
+        level->failing = false;
+    } else {
+        level->failing = true;
+    }
+}
+
+static void search_start(_self, bool forward) {
+    pl_readline_search_t search = search_get(self);
+    if (!search || !levels_reserve(search, 0)) return;
+    char *line = strdup(pl_readline_buffer_view(self));
+    if (!line) return;
+    index_update(self);
+    free(search->saved_line);
+    search->saved_line = line;
+    search->active     = true;
+    search->forward    = forward;
+    search->query_len  = 0;
+    search->levels[0]  = (search_level){0};
+}
+
+// 退出搜索，keep为false时恢复开始搜索前的输入行
+static void search_stop(_self, bool keep) {
+    pl_readline_search_t search = self->search;
+    if (search->query_len) {
+        char *query = malloc(search->query_len + 1);
+        if (query) {
+            memcpy(query, search->query, search->query_len);
+            query[search->query_len] = '\0';
+            free(search->last_query);
+            search->last_query = query;
+        }
+    }
+    while (search->query_len) {
+        search_pop(self);
+    }
+    search->active = false;
+    if (!keep) {
+        pl_readline_buffer_set(self, search->saved_line, strlen(search->saved_line));
+        self->ptr = self->length;
+    }
+    self->history_idx = 0;
+    pl_readline_set_annotation(self, NULL, 0, PL_COLOR_RESET);
+    redisplay_buffer_with_colors(self, 0);
+}
+
+bool pl_readline_search_active(_self) {
+    return self->search && self->search->active;
+}
+
+// 搜索模式下的按键，返回false表示已经退出搜索，这个键还要按普通按键处理
+bool pl_readline_search_key(_self, int ch) {
+    pl_readline_search_t search = self->search;
+    if (!search || !search->active) {
+        if (ch != PL_READLINE_KEY_CTRL_R && ch != PL_READLINE_KEY_CTRL_S) return false;
+        search_start(self, ch == PL_READLINE_KEY_CTRL_S);
+        if (self->search && self->search->active) search_show(self);
+        return true;
+    }
+    switch (ch) {
+    case PL_READLINE_KEY_CTRL_R:
+    case PL_READLINE_KEY_CTRL_S: search_next(self, ch == PL_READLINE_KEY_CTRL_S); break;
+    case PL_READLINE_KEY_BACKSPACE: search_pop(self); break;
+    case PL_READLINE_KEY_CTRL_G: search_stop(self, false); return true;
+    default:
+        if (ch >= ' ' && ch < 0x7f) {
+            search_push(self, ch);
+            break;
+        }
+        search_stop(self, true); // 其他按键：留下匹配的那一行，再照常处理
+        return false;
+    }
+    search_show(self);
+    return true;
+}
+
+// 占用的内存（字节）
+usize pl_readline_search_memory(_self) {
+    pl_readline_search_t search = self->search;
+    if (!search) return 0;
+    usize size = sizeof(struct pl_readline_search) + search->size * sizeof(trigram_postings) +
+                 search->dirty_cap * sizeof(uint32_t) + search->query_cap +
+                 search->levels_cap * sizeof(search_level);
+    for (usize i = 0; i < search->size; i++) {
+        size += search->table[i].cap * sizeof(uint32_t);
+    }
+    for (usize i = 0; search->active && i <= search->query_len; i++) {
+        if (search->levels[i].results) size += search->levels[i].count * sizeof(uint32_t);
+    }
+    if (search->saved_line) size += strlen(search->saved_line) + 1;
+    if (search->last_query) size += strlen(search->last_query) + 1;
+    return size;
+}
+
+// 不在搜索时释放搜索过程中用的内存，索引留着
+void pl_readline_search_trim(_self) {
+    pl_readline_search_t search = self->search;
+    if (!search || search->active) return;
+    free(search->levels);
+    free(search->query);
+    free(search->saved_line);
+    search->levels     = NULL;
+    search->levels_cap = 0;
+    search->query      = NULL;
+    search->query_cap  = 0;
+    search->saved_line = NULL;
+}
+
+void pl_readline_search_free(_self) {
+    pl_readline_search_t search = self->search;
+    if (!search) return;
+    while (search->query_len) {
+        search_pop(self);
+    }
+    for (usize i = 0; i < search->size; i++) {
+        free(search->table[i].seqs);
+    }
+    free(search->table);
+    free(search->dirty);
+    free(search->query);
+    free(search->levels);
+    free(search->saved_line);
+    free(search->last_query);
+    free(search);
+    self->search = NULL;
+}
@@ -0,0 +1,173 @@
+//
+// This file is part of pl_readline.
+// pl_readline is free software: you can redistribute it and/or modify
+// it under the terms of MIT license.
+// See file LICENSE or https://opensource.org/licenses/MIT for full license
+// details.
+//
+// Copyright (c) 2024 min0911_ https://github.com/min0911Y
+//
+
+// plreadln_token.c : 输入行的单词索引
+//
+// 着色、补全前缀和按单词移动光标都从这里读取单词的位置。
+// 每次编辑只从被改动的单词开始重新切分，一旦新切出的单词起点和
+// 编辑之后的某个旧单词重合，后面的单词就只需要平移，不再重新切分。
+
+#include "pl_readline.h"
+#include <string.h>
+
+static bool tokens_reserve(pl_readline_token **tokens, isize *cap, isize len) {
+    if (len <= *cap) return true;
+    isize new_cap = *cap ? *cap : 8;
+    while (new_cap < len) {
+        new_cap *= 2;
+    }
+    pl_readline_token *p = realloc(*tokens, new_cap * sizeof(pl_readline_token));
+    if (!p) return false;
+    *tokens = p;
+    *cap    = new_cap;
+    return true;
+}
+
+// 从pos（必须在单词之外）开始跳过空格，返回下一个单词的起点
+static isize skip_spaces(_self, isize pos) {
+    while (pos < self->length && pl_readline_buffer_at(self, pos) == ' ') {
+        pos++;
+    }
+    return pos;
+}
+
+// 切出从start开始的一个单词，支持引号和反斜杠转义
+static pl_readline_token lex_token(_self, isize start) {
+    pl_readline_token token = {.start = start, .kind = PL_READLINE_TOKEN_WORD};
+    char              quote = 0;
+    isize             i     = start;
+    while (i < self->length) {
+        char ch = pl_readline_buffer_at(self, i);
+        if (quote) {
+            if (ch == quote) {
+                quote = 0;
+            } else if (ch == '\\' && quote == '"') {
+                i++; // 双引号里的转义
+            }
+            i++;
+            continue;
+        }
+        if (ch == ' ') break;
+        if (ch == '\\') {
+            token.kind |= PL_READLINE_TOKEN_QUOTED;
+            i          += 2;
+            continue;
+        }
+        if (ch == '"' || ch == '\'') {
+            quote       = ch;
+            token.kind |= PL_READLINE_TOKEN_QUOTED;
+        }
+        i++;
+    }
+    if (quote || i > self->length) { // 引号没闭合或者以反斜杠结尾
+        token.kind |= PL_READLINE_TOKEN_OPEN;
+        i           = self->length;
+    }
+    token.len = i - start;
+    return token;
+}
+
+// 第一个结束位置不小于pos的单词
+static isize token_after(_self, isize pos) {
+    isize lo = 0, hi = self->token_count;
+    while (lo < hi) {
+        isize mid = (lo + hi) / 2;
+        if (self->tokens[mid].start + self->tokens[mid].len < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void pl_readline_tokens_update(_self, isize pos, isize removed, isize inserted) {
+    isize delta   = inserted - removed;
+    isize old_end = pos + removed;  // 旧坐标下编辑区域的结尾
+    isize new_end = pos + inserted; // 新坐标下编辑区域的结尾
+    isize k       = token_after(self, pos);
+    isize from    = pos;
+    if (k < self->token_count && self->tokens[k].start < from) from = self->tokens[k].start;
+    if (from < self->dirty_from) self->dirty_from = from;
+
+    // 重新切分，直到和编辑之后的旧单词对齐
+    isize count = 0;
+    isize j     = k;
+    isize i     = skip_spaces(self, from);
+    while (i < self->length) {
+        if (i >= new_end) {
+            while (j < self->token_count && self->tokens[j].start + delta < i) {
+                j++;
+            }
+            if (j < self->token_count && self->tokens[j].start + delta == i &&
+                self->tokens[j].start >= old_end) {
+                break; // 后面的单词没有变化
+            }
+        }
+        if (!tokens_reserve(&self->token_scratch, &self->token_scratch_cap, count + 1)) break;
+        pl_readline_token token      = lex_token(self, i);
+        self->token_scratch[count++] = token;
+        i                            = skip_spaces(self, token.start + token.len);
+    }
+    if (i >= self->length) j = self->token_count; // 切到了行尾，旧单词全部作废
+    pl_readline_spans_update(self, pos, removed, inserted, from, i);
+
+    // 用新切出的单词替换 [k, j)，后面的单词平移
+    isize tail      = self->token_count - j;
+    isize new_count = k + count + tail;
+    if (!tokens_reserve(&self->tokens, &self->token_cap, new_count)) return;
+    if (tail) memmove(self->tokens + k + count, self->tokens + j, tail * sizeof(pl_readline_token));
+    if (count) memcpy(self->tokens + k, self->token_scratch, count * sizeof(pl_readline_token));
+    for (isize n = k + count; n < new_count; n++) {
+        self->tokens[n].start += delta;
+    }
+    self->token_count = new_count;
+    // 第一个单词变了，原来的第二个单词可能要按第一个单词来着色
+    if (k == 0 && count < new_count) self->tokens[count].kind &= ~PL_READLINE_TOKEN_COLORED;
+}
+
+void pl_readline_tokens_reset(_self) {
+    self->token_count = 0;
+    self->dirty_from  = 0;
+}
+
+isize pl_readline_token_at(_self, isize pos) {
+    isize idx = token_after(self, pos);
+    if (idx < self->token_count && self->tokens[idx].start <= pos) return idx;
+    return -1;
+}
+
+bool pl_readline_token_is_first(_self, isize start) {
+#if PL_ENABLE_COLOR_FIRST_WORD_ONLY
+    (void)self;
+    return start == 0;
+#else
+    return self->token_count == 0 || self->tokens[0].start >= start;
+#endif
+}
+
+// 光标所在单词（补全的前缀）的起始位置
+isize pl_readline_word_start(_self) {
+    isize idx = pl_readline_token_at(self, self->ptr);
+    return idx < 0 ? self->ptr : self->tokens[idx].start;
+}
+
+// 光标左边最近的单词开头
+isize pl_readline_word_left(_self) {
+    isize idx = token_after(self, self->ptr);
+    if (idx == self->token_count || self->tokens[idx].start >= self->ptr) idx--;
+    return idx < 0 ? 0 : self->tokens[idx].start;
+}
+
+// 光标右边最近的单词结尾
+isize pl_readline_word_right(_self) {
+    isize idx = token_after(self, self->ptr + 1);
+    return idx == self->token_count ? self->length : self->tokens[idx].start + self->tokens[idx].len;
+}
@@ -28,8 +28,64 @@ void pl_readline_delete_char(char *str, int idx) {
     str[len] = '\0';
 }
 
-void pl_readline_print(_self, char *str) {
-    while (*str) {
-        self->pl_readline_hal_putch(*str++);
+// 直接把数据交给HAL，优先使用批量输出函数
+static void pl_readline_hal_output(_self, const char *buf, usize len) {
+    if (!len) return;
+    PL_READLINE_COUNT(self, write_bytes, len);
+    if (self->pl_readline_hal_write) {
+        while (len) {
+            PL_READLINE_COUNT(self, write_calls, 1);
+            int n = self->pl_readline_hal_write(buf, len);
+            if (n <= 0) break; // 写不出去了，剩下的交给putch
+            buf += n;
+            len -= n;
+        }
     }
+    PL_READLINE_COUNT(self, write_calls, len);
+    while (len--) {
+        self->pl_readline_hal_putch(*buf++);
+    }
+}
+
+// 输出和补全的统计，第一次调用时创建，之前的不算在内；分配失败返回NULL
+pl_readline_stats *pl_readline_get_stats(_self) {
+    if (!self->stats) self->stats = calloc(1, sizeof(pl_readline_stats));
+    return self->stats;
+}
+
+void pl_readline_write(_self, const char *buf, usize len) {
+    if (self->out_len + len > self->out_cap) {
+        usize cap = self->out_cap ? self->out_cap : 64; // 短行用不超过 PL_READLINE_IDLE_KEEP，留给下一行
+        while (self->out_len + len > cap) {
+            cap *= 2;
+        }
+        char *p = realloc(self->out_buf, cap);
+        if (!p) { // 分配失败，先把已有的刷出去再直接输出
+            pl_readline_hal_output(self, self->out_buf, self->out_len);
+            self->out_len = 0;
+            pl_readline_hal_output(self, buf, len);
+            return;
+        }
+        self->out_buf = p;
+        self->out_cap = cap;
+    }
+    memcpy(self->out_buf + self->out_len, buf, len);
+    self->out_len += len;
+}
+
+void pl_readline_putch(_self, int ch) {
+    char c = ch;
+    pl_readline_write(self, &c, 1);
+}
+
+void pl_readline_print(_self, const char *str) {
+    pl_readline_write(self, str, strlen(str));
+}
+
+// 把输出缓冲区中的内容一次性交给HAL
+void pl_readline_flush(_self) {
+    if (!self->out_len) return;
+    pl_readline_hal_output(self, self->out_buf, self->out_len);
+    self->out_len = 0;
+    if (self->pl_readline_hal_flush) self->pl_readline_hal_flush();
 }
\ No newline at end of file
@@ -9,45 +9,137 @@
 //
 
 // plreadln_wordmk.c: pl_readline word maker
+//
+// 词组的字符串都分配在一块块的内存池（arena）里，清空时只需要把指针拨回第一块，
+// 用过的内存留到下一次继续使用，不再逐个 free。
 
 #include "pl_readline.h"
 #include <stdlib.h>
 #include <string.h>
 
+struct pl_readline_arena_chunk {
+    struct pl_readline_arena_chunk *next;
+    usize                           cap;
+    char                            data[];
+};
+
 pl_readline_words_t pl_readline_word_maker_init(void) {
-    pl_readline_words_t words = malloc(sizeof(struct pl_readline_words));
-    words->len                = 0;  // initial length
-    words->max_len            = 16; // initial max length
-    words->words              = malloc(words->max_len * sizeof(pl_readline_word));
-    return words;
+    pl_readline_words_t words = calloc(1, sizeof(struct pl_readline_words));
+    if (!words) return NULL;
+    return words; // 词组列表和内存池都在第一次添加时才分配
+}
+
+// 实例上反复使用的词组，第一次用到时才创建；分配失败返回NULL
+pl_readline_words_t pl_readline_word_maker_get(pl_readline_words_t *words) {
+    if (!*words) *words = pl_readline_word_maker_init();
+    return *words;
 }
 
 void pl_readline_word_maker_destroy(pl_readline_words_t words) {
-    for (isize i = 0; i < words->len; i++) {
-        char *p = words->words[i].word;
-        free(p);
+    struct pl_readline_arena_chunk *chunk = words->chunks;
+    while (chunk) {
+        struct pl_readline_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
     free(words->words);
     free(words);
 }
 
-int pl_readline_word_maker_add(char *word, pl_readline_words_t words, bool is_first, int color,
-                               char sep) {
+// 从内存池中分配size字节，当前块放不下时换到下一块，没有就新建一块
+static char *arena_alloc(pl_readline_words_t words, usize size) {
+    struct pl_readline_arena_chunk *chunk = words->chunk;
+    while (chunk) {
+        if (words->used + size <= chunk->cap) {
+            char *p      = chunk->data + words->used;
+            words->used += size;
+            return p;
+        }
+        if (!chunk->next) break;
+        chunk        = chunk->next;
+        words->chunk = chunk;
+        words->used  = 0;
+    }
+    usize cap = chunk ? chunk->cap * 2 : PL_READLINE_WORDS_ARENA_SIZE;
+    while (cap < size) {
+        cap *= 2;
+    }
+    struct pl_readline_arena_chunk *new_chunk = malloc(sizeof(*new_chunk) + cap);
+    if (!new_chunk) return NULL;
+    new_chunk->next = NULL;
+    new_chunk->cap  = cap;
+    if (chunk) {
+        chunk->next = new_chunk;
+    } else {
+        words->chunks = new_chunk;
+    }
+    words->chunk = new_chunk;
+    words->used  = size;
+    return new_chunk->data;
+}
+
+// 添加一个词组，word 直接保存不复制
+int pl_readline_word_maker_add_ref(const char *word, pl_readline_words_t words, bool is_first,
+                                   int color, char sep) {
     if (words->len >= words->max_len) {
-        words->max_len *= 2;
-        words->words    = realloc(words->words, words->max_len * sizeof(pl_readline_word));
+        isize             max_len = words->max_len ? words->max_len * 2 : 16;
+        pl_readline_word *p       = realloc(words->words, max_len * sizeof(pl_readline_word));
+        if (!p) return PL_READLINE_FAILED;
+        words->words   = p;
+        words->max_len = max_len;
     }
     words->words[words->len].first = is_first;
-    words->words[words->len].word  = strdup(word);
+    words->words[words->len].word  = (char *)word;
     words->words[words->len].sep   = sep;
     words->words[words->len].color = color;
     words->len++;
-    return 0;
+    return PL_READLINE_SUCCESS;
 }
 
+int pl_readline_word_maker_add(char *word, pl_readline_words_t words, bool is_first, int color,
+                               char sep) {
+    usize size = strlen(word) + 1;
+    char *copy = arena_alloc(words, size);
+    if (!copy) return PL_READLINE_FAILED;
+    memcpy(copy, word, size);
+    return pl_readline_word_maker_add_ref(copy, words, is_first, color, sep);
+}
+
+// 清空词组，内存池保留下来给下一次用
 void pl_readline_word_maker_clear(pl_readline_words_t words) {
-    for (isize i = 0; i < words->len; i++) {
-        free(words->words[i].word);
+    words->len   = 0;
+    words->chunk = words->chunks;
+    words->used  = 0;
+}
+
+// 占用的内存（字节）
+usize pl_readline_word_maker_memory(pl_readline_words_t words) {
+    if (!words) return 0;
+    usize size = sizeof(struct pl_readline_words) + words->max_len * sizeof(pl_readline_word);
+    for (struct pl_readline_arena_chunk *chunk = words->chunks; chunk; chunk = chunk->next) {
+        size += sizeof(*chunk) + chunk->cap;
+    }
+    return size;
+}
+
+// 清空词组，占用超过keep字节的词组列表和内存池都释放掉
+void pl_readline_word_maker_trim(pl_readline_words_t words, usize keep) {
+    if (!words) return;
+    pl_readline_word_maker_clear(words);
+    if (words->max_len * sizeof(pl_readline_word) > keep) {
+        free(words->words);
+        words->words   = NULL;
+        words->max_len = 0;
+    }
+    usize arena = 0;
+    for (struct pl_readline_arena_chunk *chunk = words->chunks; chunk; chunk = chunk->next) {
+        arena += chunk->cap;
+    }
+    if (arena <= keep) return;
+    while (words->chunks) {
+        struct pl_readline_arena_chunk *next = words->chunks->next;
+        free(words->chunks);
+        words->chunks = next;
     }
-    words->len = 0;
+    words->chunk = NULL;
 }